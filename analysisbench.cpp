@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Triple.h>
+#include "corpus.hpp"
+#include "costmodel.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFile(cl::Positional,
+                                      cl::desc("<LLVM IR/bitcode file>"),
+                                      cl::Required, cl::value_desc("file"));
+static cl::opt<uint32_t> Repeat("repeat",
+                                cl::desc("Number of passes over the module"),
+                                cl::init(10), cl::value_desc("N"));
+
+// Sets up the analyses of feature extraction from scratch for one function,
+// including the library info of the module's triple.
+static uint64_t setUpFresh(Function &F) {
+  AssumptionCache AC{F};
+  DominatorTree DT{F};
+  TargetLibraryInfoImpl TLII{Triple(F.getParent()->getTargetTriple())};
+  TargetLibraryInfo TLI{TLII};
+  LoopInfo LI{DT};
+  BranchProbabilityInfo BPI{F, LI, &TLI, &DT};
+  BlockFrequencyInfo BFI{F, BPI, LI};
+  return BFI.getEntryFreq().getFrequency() + AC.assumptions().size();
+}
+
+// Same analyses, taken from the shared managers.
+static uint64_t setUpShared(Function &F, FeatureAnalyses &Analyses) {
+  auto &Target = Analyses.get(F);
+  auto &FAM = Target.FAM;
+  TargetLibraryInfo TLI{Target.TLII};
+  auto &AC = FAM.getResult<AssumptionAnalysis>(F);
+  FAM.getResult<DominatorTreeAnalysis>(F);
+  auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(F);
+  uint64_t Result = BFI.getEntryFreq().getFrequency() + AC.assumptions().size();
+  FAM.clear(F, F.getName());
+  return Result;
+}
+
+// Times the per-function analysis setup of feature extraction, building
+// everything per function versus reusing one analysis manager per triple.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "analysis setup benchmark\n");
+  if (Repeat == 0) {
+    errs() << "-repeat must be at least 1\n";
+    return EXIT_FAILURE;
+  }
+
+  LLVMContext Context;
+  auto M = loadModule(std::string(InputFile), Context);
+  if (!M)
+    return EXIT_FAILURE;
+  std::vector<Function *> Functions;
+  for (auto &F : *M)
+    if (materializeBody(F))
+      Functions.push_back(&F);
+  if (Functions.empty()) {
+    errs() << "No function bodies\n";
+    return EXIT_FAILURE;
+  }
+
+  // The checksum keeps the work from being optimized away.
+  uint64_t Checksum = 0;
+  auto Time = [&](auto &&SetUp) {
+    auto Start = std::chrono::steady_clock::now();
+    for (uint32_t I = 0; I < Repeat; ++I)
+      for (auto *F : Functions)
+        Checksum += SetUp(*F);
+    std::chrono::duration<double, std::micro> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+    return Elapsed.count() / (double(Repeat) * Functions.size());
+  };
+  FeatureAnalyses Analyses;
+  double Fresh = Time(setUpFresh);
+  double Shared = Time([&](Function &F) { return setUpShared(F, Analyses); });
+
+  outs() << "Functions: " << Functions.size() << '\n';
+  outs() << "Fresh:  " << Fresh << " us/function\n";
+  outs() << "Shared: " << Shared << " us/function\n";
+  outs() << "Speedup: " << Fresh / Shared << "x\n";
+  errs() << "Checksum: " << Checksum << '\n';
+  return EXIT_SUCCESS;
+}
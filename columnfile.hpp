@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/EndianStream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+
+// A file of columns. Each column is a sequence of fixed-width little-endian
+// integers or NUL-terminated names, so that a column can be loaded (or mapped
+// into numpy) with a linear copy. The header holds a magic number, a format
+// version, a record count whose meaning is up to the format, and the byte
+// size of every column; the columns follow in order.
+template <size_t NumColumns> class ColumnWriter final {
+  std::array<std::string, NumColumns> Columns;
+
+public:
+  template <typename T> void put(uint32_t Column, T Value) {
+    char Buf[sizeof(T)];
+    llvm::support::endian::write<T, llvm::endianness::little>(Buf, Value);
+    Columns[Column].append(Buf, sizeof(T));
+  }
+  void putName(uint32_t Column, llvm::StringRef Name) {
+    Columns[Column].append(Name.data(), Name.size());
+    Columns[Column].push_back('\0');
+  }
+
+  bool write(const std::string &Path, uint32_t Magic, uint32_t Version,
+             uint32_t Count, std::string &Err) const {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC);
+    if (EC) {
+      Err = Path + ": " + EC.message();
+      return false;
+    }
+    llvm::support::endian::Writer W(OS, llvm::endianness::little);
+    W.write<uint32_t>(Magic);
+    W.write<uint32_t>(Version);
+    W.write<uint32_t>(Count);
+    for (auto &Column : Columns)
+      W.write<uint64_t>(Column.size());
+    for (auto &Column : Columns)
+      OS << Column;
+    return true;
+  }
+};
+
+template <size_t NumColumns> class ColumnReader final {
+  std::unique_ptr<llvm::MemoryBuffer> Buf;
+  // Unread part of each column.
+  std::array<llvm::StringRef, NumColumns> Columns;
+  uint32_t Count = 0;
+  bool Truncated = false;
+
+public:
+  bool open(const std::string &Path, uint32_t Magic, uint32_t Version,
+            std::string &Err) {
+    auto BufOrErr = llvm::MemoryBuffer::getFile(Path);
+    if (!BufOrErr) {
+      Err = Path + ": " + BufOrErr.getError().message();
+      return false;
+    }
+    Buf = std::move(*BufOrErr);
+    llvm::StringRef Data = Buf->getBuffer();
+    constexpr size_t HeaderSize = 12 + 8 * NumColumns;
+    using namespace llvm::support::endian;
+    if (Data.size() < HeaderSize || read32le(Data.data()) != Magic) {
+      Err = Path + ": unexpected file format";
+      return false;
+    }
+    if (read32le(Data.data() + 4) != Version) {
+      Err = Path + ": format version mismatch";
+      return false;
+    }
+    Count = read32le(Data.data() + 8);
+    size_t Offset = HeaderSize;
+    for (size_t I = 0; I < NumColumns; ++I) {
+      uint64_t Size = read64le(Data.data() + 12 + 8 * I);
+      if (Size > Data.size() - Offset) {
+        Err = Path + ": truncated file";
+        return false;
+      }
+      Columns[I] = Data.substr(Offset, Size);
+      Offset += Size;
+    }
+    return true;
+  }
+
+  uint32_t getCount() const { return Count; }
+  // Set once a read ran past the end of a column.
+  bool isTruncated() const { return Truncated; }
+  // Unread bytes of Column.
+  size_t getRemaining(uint32_t Column) const { return Columns[Column].size(); }
+
+  template <typename T> T get(uint32_t Column) {
+    auto &Data = Columns[Column];
+    if (Data.size() < sizeof(T)) {
+      Truncated = true;
+      return T{};
+    }
+    T Value = llvm::support::endian::read<T, llvm::endianness::little>(
+        Data.data());
+    Data = Data.drop_front(sizeof(T));
+    return Value;
+  }
+  std::string getName(uint32_t Column) {
+    auto &Data = Columns[Column];
+    auto End = Data.find('\0');
+    if (End == llvm::StringRef::npos) {
+      Truncated = true;
+      return {};
+    }
+    std::string Name = Data.substr(0, End).str();
+    Data = Data.drop_front(End + 1);
+    return Name;
+  }
+};
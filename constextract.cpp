@@ -35,6 +35,8 @@
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/raw_ostream.h>
+#include "corpus.hpp"
+#include "worker.hpp"
 #include <cstdint>
 #include <cstdlib>
 #include <filesystem>
@@ -42,64 +44,132 @@
 #include <map>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 using namespace llvm;
 namespace fs = std::filesystem;
 
 static cl::opt<std::string>
-    InputDir(cl::Positional, cl::desc("<directory for input LLVM IR files>"),
+    InputDir(cl::Positional,
+             cl::desc("<directory or pack of input LLVM IR/bitcode files>"),
              cl::Required, cl::value_desc("inputdir"));
+static cl::opt<uint32_t> Jobs("j",
+                              cl::desc("Number of worker threads (0 = all "
+                                       "hardware threads)"),
+                              cl::init(1), cl::value_desc("N"));
+static cl::opt<uint32_t> ModulesPerContext(
+    "modules-per-context",
+    cl::desc("Recreate the LLVMContext after N modules (0 = never)"),
+    cl::init(0), cl::value_desc("N"));
+static cl::opt<std::string>
+    ManifestFile("manifest",
+                 cl::desc("Read the input paths from this file (one per "
+                          "line) instead of walking inputdir"),
+                 cl::value_desc("file"));
+static cl::opt<bool>
+    DedupFiles("dedup-files",
+               cl::desc("Hash every input before parsing and parse each "
+                        "distinct content once, counting its constants once "
+                        "per copy"));
+static cl::opt<std::string>
+    ShardSpec("shard",
+              cl::desc("Only scan shard i of N of the inputs and write "
+                       "constdist.i-of-N.txt (combine them with "
+                       "mergeshards)"),
+              cl::value_desc("i/N"));
 
 int main(int argc, char **argv) {
   InitLLVM Init{argc, argv};
   cl::ParseCommandLineOptions(argc, argv, "scanner\n");
 
-  std::vector<fs::path> InputFiles;
-  for (auto &Entry : fs::recursive_directory_iterator(std::string(InputDir))) {
-    if (Entry.is_regular_file()) {
-      auto &Path = Entry.path();
-      if (Path.extension() == ".ll" &&
-          Path.string().find("optimized") != std::string::npos)
-        InputFiles.push_back(Path);
-    }
+  Shard Part;
+  std::string Err;
+  if (!ShardSpec.empty() && !Part.parse(ShardSpec, Err)) {
+    errs() << Err << '\n';
+    return EXIT_FAILURE;
   }
-  errs() << "Input files: " << InputFiles.size() << '\n';
-  LLVMContext Context;
-  std::map<int64_t, uint32_t> ValDist;
-  uint32_t Count = 0;
+
+  // Every worker fills its own histogram; they are summed once all inputs
+  // are processed, which yields the same table as a serial scan.
+  uint32_t NumWorkers = getNumWorkers(Jobs);
+  std::vector<std::map<int64_t, uint32_t>> WorkerValDist(NumWorkers);
+  auto Inputs = openInputs(InputDir, "optimized", ManifestFile, Part,
+                           /*ByProject=*/false);
+  ProgressCounter Progress;
 
   using namespace PatternMatch;
 
-  for (auto &Path : InputFiles) {
-    SMDiagnostic Err;
-    auto M = parseIRFile(Path.string(), Err, Context);
-    if (!M)
-      continue;
+  std::vector<InputGroup> Groups;
+  if (DedupFiles) {
+    Groups = groupInputsByContent(*Inputs, NumWorkers);
+    printDedupRatio(Groups);
+  }
+  WorkQueue GroupQueue{Groups.size()};
 
-    for (auto &F : *M) {
-      if (F.empty())
+  runWorkers(NumWorkers, [&](uint32_t WorkerIdx) {
+    ContextRecycler Contexts{ModulesPerContext};
+    auto &ValDist = WorkerValDist[WorkerIdx];
+    // Copies of the module being scanned.
+    uint32_t Copies = 1;
+    auto Next = [&](fs::path &Path) {
+      if (!DedupFiles)
+        return Inputs->pop(Path);
+      size_t Idx;
+      if (!GroupQueue.pop(Idx))
+        return false;
+      Path = Groups[Idx].Paths.front();
+      Copies = Groups[Idx].Paths.size();
+      if (Idx + InputFeed::ReadAhead < Groups.size())
+        Inputs->prefetch(Groups[Idx + InputFeed::ReadAhead].Paths.front());
+      return true;
+    };
+    fs::path Path;
+    while (Next(Path)) {
+      auto Buf = Inputs->read(Path);
+      if (!Buf)
+        continue;
+      auto M = loadModule(std::move(Buf), Contexts.get());
+      if (!M)
         continue;
 
-      for (auto &BB : F) {
-        for (auto &I : BB) {
-          for (Value *Op : I.operands()) {
-            match(Op, m_CheckedInt([&](const APInt &V) {
-                    if (V.getBitWidth() > 64)
-                      return false;
-                    ValDist[V.getSExtValue()]++;
-                    return true;
-                  }));
-            // match(Op, m_CheckedFp([&](const APFloat &V) { return true; }));
+      for (auto &F : *M) {
+        if (!materializeBody(F))
+          continue;
+
+        for (auto &BB : F) {
+          for (auto &I : BB) {
+            for (Value *Op : I.operands()) {
+              match(Op, m_CheckedInt([&](const APInt &V) {
+                      if (V.getBitWidth() > 64)
+                        return false;
+                      ValDist[V.getSExtValue()] += Copies;
+                      return true;
+                    }));
+              // match(Op, m_CheckedFp([&](const APFloat &V) { return true; }));
+            }
           }
         }
       }
-    }
 
-    errs() << "\rProgress: " << ++Count;
-  }
+      Progress.step();
+    }
+  });
   errs() << '\n';
+  errs() << "Input files: " << Inputs->finish(Err) << '\n';
+  if (!Err.empty()) {
+    errs() << Err << '\n';
+    return EXIT_FAILURE;
+  }
+  errs() << "Peak RSS: " << getPeakRSSInMiB() << " MiB\n";
+
+  auto &ValDist = WorkerValDist.front();
+  for (uint32_t I = 1; I < NumWorkers; ++I)
+    for (auto [K, V] : WorkerValDist[I])
+      ValDist[K] += V;
 
-  std::ofstream OutFile("constdist.txt");
+  std::ofstream OutFile(Part.getOutputName("constdist.txt"));
+  if (Part.Count > 1)
+    OutFile << Part.getHeader() << '\n';
   for (auto [K, V] : ValDist)
     OutFile << K << ' ' << V << '\n';
 
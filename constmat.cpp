@@ -4,30 +4,44 @@
 // See the LICENSE file for more information.
 
 #include <llvm/Support/MathExtras.h>
+#include "isa.hpp"
 #include <fstream>
 #include <iostream>
 
 using namespace llvm;
 
-static uint32_t getMatCost(int64_t V) {
+// Tiers of costestimate's getMaterializationCost: one instruction, a LUI +
+// ADDI pair, or a constant pool load.
+static uint64_t getMatCost(const ISAConfig &ISA, const ISARanges &Imm,
+                           int64_t V) {
   if (V == 0 || V == 1)
     return 0;
 
-  if (isInt<12>(V))
+  if (Imm.LargeImmBits.fitsSigned(V))
     return 1;
 
   // uint32_t Idx, Len;
   // if (isShiftedMask_64(V, Idx, Len) && Len <= 6)
   //   return 1;
 
-  if (isInt<32>(V))
+  if (Imm.LargeAddSubImmBits.fitsSigned(V))
     return 2;
 
   // Load from constant pool
-  return 4;
+  return ISA.LoadStoreCost;
 }
 
-int main() {
+int main(int argc, char **argv) {
+  ISAConfig ISA;
+  if (argc > 1) {
+    std::string Err;
+    if (!ISA.load(argv[1], Err)) {
+      std::cerr << Err << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+
+  ISARanges Imm{ISA};
   std::ifstream File("constdist.txt");
   if (!File.is_open())
     return EXIT_FAILURE;
@@ -36,7 +50,7 @@ int main() {
   uint32_t v;
   uint64_t sum = 0;
   while (File >> k >> v) {
-    sum += getMatCost(k) * v;
+    sum += getMatCost(ISA, Imm, k) * v;
   }
 
   std::cout << "Cost: " << sum << std::endl;
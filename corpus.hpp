@@ -0,0 +1,437 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include "corpuspack.hpp"
+#include "worker.hpp"
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Textual IR (.ll) or its bitcode mirror (.bc).
+inline bool isIRFile(const std::filesystem::path &Path) {
+  auto Ext = Path.extension();
+  return Ext == ".ll" || Ext == ".bc";
+}
+
+// Buffers go to the IR reader as is (see loadModule), and files of 16 KiB or
+// more are mapped rather than copied to the heap. Textual IR needs a NUL
+// after its last byte, which a mapping cannot provide if the size is a
+// multiple of the page size; bitcode does not, so it is always mapped.
+// Mappings are parsed front to back, which lets the kernel read ahead and
+// drop the pages behind the parser early.
+inline std::unique_ptr<llvm::MemoryBuffer>
+readInput(const std::filesystem::path &Path) {
+  auto Buf = llvm::MemoryBuffer::getFile(
+      Path.string(), /*IsText=*/false,
+      /*RequiresNullTerminator=*/Path.extension() != ".bc");
+  if (!Buf)
+    return nullptr;
+  if ((*Buf)->getBufferKind() == llvm::MemoryBuffer::MemoryBuffer_MMap)
+    adviseMapping((*Buf)->getBuffer(), MADV_SEQUENTIAL);
+  return std::move(*Buf);
+}
+
+// Hands input files to the workers while a producer thread is still
+// enumerating them, so that parsing starts before a slow (e.g. network
+// mounted) directory walk has finished. IR files under Dir whose path
+// contains Pattern are fed in batches of WalkBatch files in the order the walk
+// finds them, and each batch is ordered largest first like
+// sortLargestFirst(). Unlike sorting the whole corpus, this cannot keep a big
+// module that the walk finds late from finishing last; a manifest or a pack
+// that lists large modules first avoids that.
+//
+// If Manifest is not empty the walk is skipped: the manifest lists one path
+// per line (relative to Dir or absolute), which is fed in order after the same
+// filtering, so a manifest that lists large modules first avoids stragglers.
+//
+// If Dir is a corpus pack (see corpuspack.hpp) rather than a directory, its
+// members are fed in pack order as paths under Dir. Inputs are read with
+// read(), which serves them from the pack without touching the file system.
+//
+// Whenever a path is handed out, the path that is now ReadAhead places from
+// the front of the queue is prefetched, so that workers rarely wait for the
+// disk.
+class InputFeed final {
+  std::string Root;
+  std::shared_ptr<const CorpusPack> Pack;
+  std::mutex Lock;
+  std::condition_variable Ready;
+  std::deque<std::filesystem::path> Pending;
+  size_t Count = 0;
+  bool Done = false;
+  std::string Error;
+  std::thread Producer;
+
+  static bool isWanted(const std::filesystem::path &Path,
+                       std::string_view Pattern) {
+    return isIRFile(Path) && Path.string().find(Pattern) != std::string::npos;
+  }
+  void push(const std::filesystem::path &Path, std::string_view Pattern) {
+    if (!isWanted(Path, Pattern))
+      return;
+    {
+      std::lock_guard Guard{Lock};
+      Pending.push_back(Path);
+      ++Count;
+    }
+    Ready.notify_one();
+  }
+  void pushBatch(std::vector<std::filesystem::path> &Batch) {
+    sortLargestFirst(Batch);
+    {
+      std::lock_guard Guard{Lock};
+      std::move(Batch.begin(), Batch.end(), std::back_inserter(Pending));
+      Count += Batch.size();
+    }
+    Ready.notify_all();
+    Batch.clear();
+  }
+  void produce(const std::string &Pattern, const std::string &Manifest) {
+    std::string Err;
+    if (Manifest.empty() && Pack) {
+      for (uint32_t Idx = 0; Idx < Pack->getNumMembers(); ++Idx)
+        push(std::filesystem::path(Root) / Pack->getName(Idx).str(), Pattern);
+    } else if (Manifest.empty()) {
+      std::error_code EC;
+      std::vector<std::filesystem::path> Batch;
+      for (std::filesystem::recursive_directory_iterator It{Root, EC}, End;
+           !EC && It != End; It.increment(EC)) {
+        std::error_code TypeEC;
+        if (!It->is_regular_file(TypeEC) || !isWanted(It->path(), Pattern))
+          continue;
+        Batch.push_back(It->path());
+        if (Batch.size() == WalkBatch)
+          pushBatch(Batch);
+      }
+      pushBatch(Batch);
+      if (EC)
+        Err = Root + ": " + EC.message();
+    } else if (std::ifstream File(Manifest); File.is_open()) {
+      std::string Line;
+      while (std::getline(File, Line))
+        if (!Line.empty())
+          push(std::filesystem::path(Root) / Line, Pattern);
+    } else
+      Err = "cannot open " + Manifest;
+    {
+      std::lock_guard Guard{Lock};
+      Done = true;
+      Error = std::move(Err);
+    }
+    Ready.notify_all();
+  }
+
+public:
+  static constexpr size_t WalkBatch = 256;
+
+  InputFeed(const std::string &Dir, std::string_view Pattern,
+            const std::string &Manifest)
+      : Root{Dir} {
+    std::error_code EC;
+    if (std::filesystem::is_regular_file(Dir, EC)) {
+      auto Opened = std::make_shared<CorpusPack>();
+      if (!Opened->open(Dir, Error)) {
+        Done = true;
+        return;
+      }
+      Pack = std::move(Opened);
+    }
+    Producer = std::thread{[this, Pattern = std::string(Pattern), Manifest] {
+      produce(Pattern, Manifest);
+    }};
+  }
+  // Feeds a fixed list of paths of the same inputs as Source. Err is reported
+  // by finish().
+  InputFeed(const InputFeed &Source, std::vector<std::filesystem::path> Paths,
+            std::string Err)
+      : Root{Source.Root}, Pack{Source.Pack},
+        Pending(std::make_move_iterator(Paths.begin()),
+                std::make_move_iterator(Paths.end())),
+        Count(Pending.size()), Done(true), Error(std::move(Err)) {}
+  ~InputFeed() {
+    if (Producer.joinable())
+      Producer.join();
+  }
+
+  static constexpr size_t ReadAhead = 8;
+
+  // Blocks until a path is available. Returns false once every path has been
+  // handed out.
+  bool pop(std::filesystem::path &Path) {
+    std::filesystem::path Upcoming;
+    {
+      std::unique_lock Guard{Lock};
+      Ready.wait(Guard, [this] { return !Pending.empty() || Done; });
+      if (Pending.empty())
+        return false;
+      Path = std::move(Pending.front());
+      Pending.pop_front();
+      if (Pending.size() >= ReadAhead)
+        Upcoming = Pending[ReadAhead - 1];
+    }
+    if (!Upcoming.empty())
+      prefetch(Upcoming);
+    return true;
+  }
+
+  // Waits for the producer and returns the number of paths it found. Err is
+  // set if the enumeration failed part way.
+  size_t finish(std::string &Err) {
+    if (Producer.joinable())
+      Producer.join();
+    Err = Error;
+    return Count;
+  }
+
+  // Starts reading an input into memory in the background.
+  void prefetch(const std::filesystem::path &Path) const {
+    if (!Pack) {
+      adviseWillNeed(Path);
+      return;
+    }
+    auto Idx = Pack->find(Path.lexically_relative(Root).generic_string());
+    if (Idx >= 0)
+      Pack->prefetch(Idx);
+  }
+
+  // Contents of an input, or null if it cannot be read.
+  std::unique_ptr<llvm::MemoryBuffer>
+  read(const std::filesystem::path &Path) const {
+    if (!Pack)
+      return readInput(Path);
+    auto Idx = Pack->find(Path.lexically_relative(Root).generic_string());
+    return Idx < 0 ? nullptr : Pack->read(Idx);
+  }
+
+  // Size of an input, or 0 if it cannot be read.
+  uint64_t getSize(const std::filesystem::path &Path) const {
+    if (Pack) {
+      auto Idx = Pack->find(Path.lexically_relative(Root).generic_string());
+      return Idx < 0 ? 0 : Pack->getSize(Idx);
+    }
+    std::error_code EC;
+    auto Size = std::filesystem::file_size(Path, EC);
+    return EC ? 0 : Size;
+  }
+};
+
+// Part Index of Count disjoint parts of a corpus run, given as "i/N".
+struct Shard {
+  uint32_t Index = 0;
+  uint32_t Count = 1;
+
+  bool parse(std::string_view Spec, std::string &Err) {
+    auto ParseNum = [](std::string_view Str, uint32_t &Value) {
+      auto [Ptr, EC] =
+          std::from_chars(Str.data(), Str.data() + Str.size(), Value);
+      return EC == std::errc{} && Ptr == Str.data() + Str.size();
+    };
+    auto Slash = Spec.find('/');
+    if (Slash == std::string_view::npos ||
+        !ParseNum(Spec.substr(0, Slash), Index) ||
+        !ParseNum(Spec.substr(Slash + 1), Count) || Index >= Count) {
+      Err = "invalid shard '" + std::string(Spec) +
+            "', expected i/N with i < N";
+      return false;
+    }
+    return true;
+  }
+
+  // Name of the partial output of this shard: Name with ".<i>-of-<N>"
+  // before its extension, e.g. cost.0-of-4.txt.
+  std::string getOutputName(const std::string &Name) const {
+    if (Count == 1)
+      return Name;
+    std::filesystem::path Path{Name};
+    auto Stem = Path.stem().string() + "." + std::to_string(Index) + "-of-" +
+                std::to_string(Count);
+    return (Path.parent_path() / (Stem + Path.extension().string())).string();
+  }
+
+  // First line of a partial output, so that mergeshards can check that it
+  // got every shard of a run exactly once.
+  std::string getHeader() const {
+    return "Shard " + std::to_string(Index) + ' ' + std::to_string(Count);
+  }
+};
+
+// Drains Inputs and keeps the files of shard S. The files are split into
+// units, either single files or whole projects (the first component of the
+// path relative to Dir) if ByProject is set, and the units are dealt out
+// largest first to the shard with the fewest bytes so far. Units of the same
+// size are ordered by the hash of their relative path. The assignment only
+// depends on the set of inputs, so processes that see the same corpus get
+// disjoint shards that cover it.
+inline std::unique_ptr<InputFeed> selectShard(InputFeed &Inputs,
+                                              const std::string &Dir,
+                                              const Shard &S, bool ByProject) {
+  struct Unit {
+    uint64_t Size = 0;
+    uint64_t Hash = 0;
+    const std::string *Key = nullptr;
+    std::vector<std::filesystem::path> Paths;
+  };
+  std::map<std::string, Unit> Units;
+  std::filesystem::path Path;
+  while (Inputs.pop(Path)) {
+    auto Rel = Path.lexically_relative(Dir).generic_string();
+    auto &U = Units[ByProject ? Rel.substr(0, Rel.find('/')) : Rel];
+    U.Size += Inputs.getSize(Path);
+    U.Paths.push_back(std::move(Path));
+  }
+  std::string Err;
+  Inputs.finish(Err);
+
+  std::vector<Unit *> Order;
+  for (auto &[Key, U] : Units) {
+    U.Hash = llvm::xxh3_64bits(llvm::arrayRefFromStringRef(Key));
+    U.Key = &Key;
+    Order.push_back(&U);
+  }
+  std::sort(Order.begin(), Order.end(), [](const Unit *LHS, const Unit *RHS) {
+    if (LHS->Size != RHS->Size)
+      return LHS->Size > RHS->Size;
+    if (LHS->Hash != RHS->Hash)
+      return LHS->Hash < RHS->Hash;
+    return *LHS->Key < *RHS->Key;
+  });
+  std::vector<uint64_t> Load(S.Count, 0);
+  std::vector<std::filesystem::path> Selected;
+  for (auto *U : Order) {
+    auto Lightest = std::min_element(Load.begin(), Load.end());
+    *Lightest += U->Size;
+    if (static_cast<uint32_t>(Lightest - Load.begin()) == S.Index)
+      std::move(U->Paths.begin(), U->Paths.end(),
+                std::back_inserter(Selected));
+  }
+  return std::make_unique<InputFeed>(Inputs, std::move(Selected),
+                                     std::move(Err));
+}
+
+// The inputs of this process: every IR file under Dir whose path contains
+// Pattern, or only those of shard S.
+inline std::unique_ptr<InputFeed> openInputs(const std::string &Dir,
+                                             std::string_view Pattern,
+                                             const std::string &Manifest,
+                                             const Shard &S, bool ByProject) {
+  auto Inputs = std::make_unique<InputFeed>(Dir, Pattern, Manifest);
+  if (S.Count == 1)
+    return Inputs;
+  return selectShard(*Inputs, Dir, S, ByProject);
+}
+
+inline uint64_t hashContent(const llvm::MemoryBuffer &Buf) {
+  return llvm::xxh3_64bits(llvm::arrayRefFromStringRef(Buf.getBuffer()));
+}
+
+// Inputs with the same content. Only the first path is parsed; the other
+// copies reuse its results.
+struct InputGroup {
+  uint64_t Hash = 0;
+  uint64_t Size = 0;
+  std::vector<std::filesystem::path> Paths;
+};
+
+// Drains Inputs with NumWorkers threads that read and hash every file before
+// anything is parsed, and groups the files by content. Paths are sorted
+// within a group, and groups are ordered largest first like
+// sortLargestFirst(), so the result does not depend on scheduling.
+// Unreadable files are dropped.
+inline std::vector<InputGroup> groupInputsByContent(InputFeed &Inputs,
+                                                    uint32_t NumWorkers) {
+  std::mutex Lock;
+  std::map<std::pair<uint64_t, uint64_t>, std::vector<std::filesystem::path>>
+      ByContent;
+  runWorkers(NumWorkers, [&](uint32_t) {
+    std::filesystem::path Path;
+    while (Inputs.pop(Path)) {
+      auto Buf = Inputs.read(Path);
+      if (!Buf)
+        continue;
+      std::pair Key{hashContent(*Buf), uint64_t{Buf->getBufferSize()}};
+      std::lock_guard Guard{Lock};
+      ByContent[Key].push_back(std::move(Path));
+    }
+  });
+
+  std::vector<InputGroup> Groups;
+  Groups.reserve(ByContent.size());
+  for (auto &[Key, Paths] : ByContent) {
+    std::sort(Paths.begin(), Paths.end());
+    Groups.push_back({Key.first, Key.second, std::move(Paths)});
+  }
+  std::sort(Groups.begin(), Groups.end(),
+            [](const InputGroup &LHS, const InputGroup &RHS) {
+              if (LHS.Size != RHS.Size)
+                return LHS.Size > RHS.Size;
+              return LHS.Paths.front() < RHS.Paths.front();
+            });
+  return Groups;
+}
+
+inline void printDedupRatio(const std::vector<InputGroup> &Groups) {
+  size_t NumFiles = 0;
+  for (auto &Group : Groups)
+    NumFiles += Group.Paths.size();
+  size_t Copies = NumFiles - Groups.size();
+  llvm::errs() << "Unique inputs: " << Groups.size() << " / " << NumFiles
+               << llvm::format(" (%.1f%% duplicates)\n",
+                               NumFiles ? 100.0 * Copies / NumFiles : 0.0);
+}
+
+// Bitcode is loaded lazily: function bodies stay in the buffer until
+// materializeBody() is called on them. Textual IR is parsed eagerly.
+inline std::unique_ptr<llvm::Module>
+loadModule(std::unique_ptr<llvm::MemoryBuffer> Buf,
+           llvm::LLVMContext &Context) {
+  llvm::SMDiagnostic Err;
+  return llvm::getLazyIRModule(std::move(Buf), Err, Context);
+}
+
+inline std::unique_ptr<llvm::Module>
+loadModule(const std::filesystem::path &Path, llvm::LLVMContext &Context) {
+  auto Buf = readInput(Path);
+  if (!Buf)
+    return nullptr;
+  return loadModule(std::move(Buf), Context);
+}
+
+// Returns false if F is a declaration or its body cannot be read.
+inline bool materializeBody(llvm::Function &F) {
+  if (F.isDeclaration())
+    return false;
+  if (llvm::Error E = F.materialize()) {
+    llvm::logAllUnhandledErrors(std::move(E), llvm::errs(),
+                                F.getName() + ": ");
+    return false;
+  }
+  return !F.empty();
+}
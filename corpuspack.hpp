@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Compression.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/EndianStream.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include "worker.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <system_error>
+#include <vector>
+
+// A corpus pack stores many IR files in one file, so that a scan opens and
+// maps a single file instead of tens of thousands. The 24-byte header holds a
+// magic number, a format version, the member count, the offset of the index
+// and four reserved bytes. Then come the members, each followed by a NUL
+// byte, so that textual IR can be parsed in place, and padded to 8 bytes. The
+// index lists the name of every member (its path relative to the packed
+// directory, NUL-terminated) followed by its offset, stored size and size. A
+// member whose stored size differs from its size is zstd-compressed.
+constexpr uint32_t CorpusPackMagic = 0x4B503652; // "R6PK"
+constexpr uint32_t CorpusPackVersion = 1;
+constexpr uint64_t CorpusPackHeaderSize = 24;
+
+class CorpusPackWriter final {
+  llvm::raw_fd_ostream &OS;
+  struct Entry {
+    std::string Name;
+    uint64_t Offset;
+    uint64_t StoredSize;
+    uint64_t Size;
+  };
+  std::vector<Entry> Index;
+
+public:
+  // OS must be a seekable file stream.
+  explicit CorpusPackWriter(llvm::raw_fd_ostream &OS) : OS{OS} {
+    OS.write_zeros(CorpusPackHeaderSize);
+  }
+
+  // Adds a member of Size bytes stored as Data, which is compressed if it is
+  // shorter than Size.
+  void add(llvm::StringRef Name, llvm::StringRef Data, uint64_t Size) {
+    Index.push_back({Name.str(), OS.tell(), Data.size(), Size});
+    OS << Data;
+    OS.write_zeros(1 + (7 - Data.size() % 8));
+  }
+
+  // Writes the index and the header.
+  bool finish(std::string &Err) {
+    uint64_t IndexOffset = OS.tell();
+    llvm::support::endian::Writer W(OS, llvm::endianness::little);
+    for (auto &E : Index) {
+      OS << E.Name << '\0';
+      W.write<uint64_t>(E.Offset);
+      W.write<uint64_t>(E.StoredSize);
+      W.write<uint64_t>(E.Size);
+    }
+    OS.seek(0);
+    W.write<uint32_t>(CorpusPackMagic);
+    W.write<uint32_t>(CorpusPackVersion);
+    W.write<uint32_t>(Index.size());
+    W.write<uint64_t>(IndexOffset);
+    W.write<uint32_t>(0);
+    OS.flush();
+    if (OS.has_error()) {
+      Err = OS.error().message();
+      OS.clear_error();
+      return false;
+    }
+    return true;
+  }
+};
+
+class CorpusPack final {
+  std::unique_ptr<llvm::MemoryBuffer> Buf;
+  struct Member {
+    llvm::StringRef Name;
+    uint64_t Offset;
+    uint64_t StoredSize;
+    uint64_t Size;
+  };
+  std::vector<Member> Members;
+  llvm::StringMap<uint32_t> ByName;
+
+public:
+  // The pack is mapped as a whole; members are read from the mapping, mostly
+  // in pack order.
+  bool isMapped() const {
+    return Buf->getBufferKind() == llvm::MemoryBuffer::MemoryBuffer_MMap;
+  }
+  bool open(const std::string &Path, std::string &Err) {
+    auto BufOrErr = llvm::MemoryBuffer::getFile(
+        Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!BufOrErr) {
+      Err = Path + ": " + BufOrErr.getError().message();
+      return false;
+    }
+    Buf = std::move(*BufOrErr);
+    llvm::StringRef Data = Buf->getBuffer();
+    using namespace llvm::support::endian;
+    if (Data.size() < CorpusPackHeaderSize ||
+        read32le(Data.data()) != CorpusPackMagic) {
+      Err = Path + ": not a corpus pack";
+      return false;
+    }
+    if (read32le(Data.data() + 4) != CorpusPackVersion) {
+      Err = Path + ": format version mismatch";
+      return false;
+    }
+    uint32_t Count = read32le(Data.data() + 8);
+    uint64_t IndexOffset = read64le(Data.data() + 12);
+    if (IndexOffset < CorpusPackHeaderSize || IndexOffset > Data.size()) {
+      Err = Path + ": truncated file";
+      return false;
+    }
+    // Members must end with a NUL byte before the index, see
+    // CorpusPackWriter.
+    llvm::StringRef Rest = Data.substr(IndexOffset);
+    Members.resize(Count);
+    for (auto &M : Members) {
+      auto End = Rest.find('\0');
+      if (End == llvm::StringRef::npos || Rest.size() - End - 1 < 24) {
+        Err = Path + ": truncated index";
+        return false;
+      }
+      M.Name = Rest.substr(0, End);
+      const char *Fields = Rest.data() + End + 1;
+      M.Offset = read64le(Fields);
+      M.StoredSize = read64le(Fields + 8);
+      M.Size = read64le(Fields + 16);
+      Rest = Rest.drop_front(End + 25);
+      if (M.Offset < CorpusPackHeaderSize || M.Offset >= IndexOffset ||
+          M.StoredSize >= IndexOffset - M.Offset ||
+          Data[M.Offset + M.StoredSize] != '\0') {
+        Err = Path + ": malformed member " + M.Name.str();
+        return false;
+      }
+    }
+    for (uint32_t Idx = 0; Idx < Count; ++Idx)
+      ByName.try_emplace(Members[Idx].Name, Idx);
+    if (isMapped())
+      adviseMapping(Data.take_front(IndexOffset), MADV_SEQUENTIAL);
+    return true;
+  }
+
+  uint32_t getNumMembers() const { return Members.size(); }
+  llvm::StringRef getName(uint32_t Idx) const { return Members[Idx].Name; }
+  uint64_t getSize(uint32_t Idx) const { return Members[Idx].Size; }
+
+  // Index of the member called Name, or -1 if there is none.
+  int64_t find(llvm::StringRef Name) const {
+    auto It = ByName.find(Name);
+    return It == ByName.end() ? -1 : It->second;
+  }
+
+  // Starts reading member Idx into memory in the background.
+  void prefetch(uint32_t Idx) const {
+    auto &M = Members[Idx];
+    if (isMapped())
+      adviseMapping(Buf->getBuffer().substr(M.Offset, M.StoredSize),
+                    MADV_WILLNEED);
+  }
+
+  // Stored members are handed out as views of the mapping, compressed ones
+  // are inflated into a buffer of their own. Returns null if a member cannot
+  // be inflated.
+  std::unique_ptr<llvm::MemoryBuffer> read(uint32_t Idx) const {
+    auto &M = Members[Idx];
+    llvm::StringRef Stored = Buf->getBuffer().substr(M.Offset, M.StoredSize);
+    if (M.StoredSize == M.Size)
+      return llvm::MemoryBuffer::getMemBuffer(Stored, M.Name,
+                                              /*RequiresNullTerminator=*/true);
+    auto Inflated = llvm::WritableMemoryBuffer::getNewUninitMemBuffer(
+        M.Size, M.Name);
+    if (!Inflated)
+      return nullptr;
+    size_t Size = M.Size;
+    llvm::Error E = llvm::compression::zstd::decompress(
+        llvm::arrayRefFromStringRef(Stored),
+        reinterpret_cast<uint8_t *>(Inflated->getBufferStart()), Size);
+    if (!E && Size != M.Size)
+      E = llvm::createStringError(std::errc::illegal_byte_sequence,
+                                  "unexpected member size");
+    if (E) {
+      llvm::logAllUnhandledErrors(std::move(E), llvm::errs(), M.Name + ": ");
+      return nullptr;
+    }
+    return Inflated;
+  }
+};
@@ -3,749 +3,1182 @@
 // This file is licensed under the Apache-2.0 License.
 // See the LICENSE file for more information.
 
-#include <llvm/ADT/APFloat.h>
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/DenseMap.h>
-#include <llvm/ADT/FloatingPointMode.h>
-#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/STLExtras.h>
-#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/SmallVector.h>
-#include <llvm/Analysis/AssumptionCache.h>
-#include <llvm/Analysis/DomConditionCache.h>
-#include <llvm/Analysis/SimplifyQuery.h>
-#include <llvm/Analysis/TargetLibraryInfo.h>
-#include <llvm/Analysis/ValueTracking.h>
-#include <llvm/IR/BasicBlock.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/IR/Constants.h>
-#include <llvm/IR/DataLayout.h>
-#include <llvm/IR/DerivedTypes.h>
-#include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
-#include <llvm/IR/GlobalVariable.h>
-#include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/InstVisitor.h>
-#include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
-#include <llvm/IR/IntrinsicInst.h>
-#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
-#include <llvm/IR/Operator.h>
-#include <llvm/IR/PatternMatch.h>
-#include <llvm/IR/Type.h>
-#include <llvm/IR/Value.h>
-#include <llvm/IR/Verifier.h>
-#include <llvm/IRPrinter/IRPrintingPasses.h>
-#include <llvm/IRReader/IRReader.h>
+#include <llvm/IR/ProfDataUtils.h>
 #include <llvm/Support/CommandLine.h>
-#include <llvm/Support/Error.h>
-#include <llvm/Support/ErrorHandling.h>
-#include <llvm/Support/FileSystem.h>
-#include <llvm/Support/FormattedStream.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/InitLLVM.h>
-#include <llvm/Support/MathExtras.h>
 #include <llvm/Support/MemoryBuffer.h>
-#include <llvm/Support/SourceMgr.h>
-#include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
 #include <llvm/Transforms/Utils/Local.h>
-#include "immbits.hpp"
+#include "columnfile.hpp"
+#include "corpus.hpp"
+#include "costmodel.hpp"
+#include "featuredump.hpp"
+#include "isa.hpp"
+#include "worker.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
 #include <set>
+#include <sstream>
 
 using namespace llvm;
-using namespace PatternMatch;
 namespace fs = std::filesystem;
 
 static cl::opt<std::string>
-    InputDir(cl::Positional, cl::desc("<directory for input LLVM IR files>"),
-             cl::Required, cl::value_desc("inputdir"));
-
-constexpr uint64_t LoadStoreCost = 4;
-constexpr uint64_t JumpCost = 1;
-constexpr uint64_t MulCost = 3;
-constexpr uint64_t DivCost = 12;
-constexpr uint64_t FDivCost = 30;
-constexpr uint64_t FMulCost = 5;
-constexpr uint64_t FCheapOpCost = 3;
-constexpr uint64_t GlobalCost = 2;
-constexpr uint64_t BitCountCost = 3;
-constexpr uint64_t UnsupportedCost = 0;
-
-template <uint32_t K> auto m_Int() {
-  return m_CombineOr(m_Zero(), m_CheckedInt([&](const APInt &V) {
-                       if (V.getBitWidth() >= 64)
-                         return false;
-                       return isInt<K>(V.getSExtValue());
-                     }));
-}
-template <uint32_t K> auto m_UInt() {
-  return m_CombineOr(m_Zero(), m_CheckedInt([&](const APInt &V) {
-                       if (V.getBitWidth() >= 64)
-                         return false;
-                       return isUInt<K>(V.getZExtValue());
-                     }));
-}
-static auto m_ShAmt() { return m_UInt<ShAmtBits>(); }
-static auto m_BitImm() {
-  return m_CheckedInt([&](const APInt &V) {
-    if (V.getBitWidth() >= 64)
-      return false;
-    uint32_t Idx, Len;
-    if (isShiftedMask_64(V.getZExtValue(), Idx, Len) && Len <= 8)
-      return true;
-    if (V.getBitWidth() % 8 == 0 && V.isSplat(8))
-      return true;
-    if (V.countl_one() + V.countr_zero() == V.getBitWidth())
-      return true;
-    if (V.countl_zero() + V.countr_one() == V.getBitWidth())
-      return true;
-
-    return false;
-  });
-}
-static auto m_FPImm() {
-  return m_CheckedFp([&](const APFloat &V) {
-    auto Val = V;
-    bool loseInfo = false;
-    return Val.convert(APFloat::Float8E4M3FN(), APFloat::rmNearestTiesToEven,
-                       &loseInfo) == APFloat::opOK &&
-           !loseInfo;
-  });
+    InputDir(cl::Positional,
+             cl::desc("<directory or pack of input LLVM IR/bitcode files>"),
+             cl::Optional, cl::value_desc("inputdir"));
+static cl::opt<uint32_t> Jobs("j",
+                              cl::desc("Number of worker threads (0 = all "
+                                       "hardware threads)"),
+                              cl::init(1), cl::value_desc("N"));
+static cl::opt<uint32_t> ModulesPerContext(
+    "modules-per-context",
+    cl::desc("Recreate the LLVMContext after N modules (0 = never)"),
+    cl::init(0), cl::value_desc("N"));
+static cl::opt<std::string>
+    ISAFile("isa", cl::desc("ISA description (defaults to immbits.hpp)"),
+            cl::value_desc("file"));
+static cl::list<std::string>
+    Variants("variant",
+             cl::desc("Also evaluate the ISA with these overrides, e.g. "
+                      "AddSubImmBits=12,MulCost=4 (one cost column each)"),
+             cl::value_desc("spec"));
+static cl::opt<std::string>
+    CacheFile("cache",
+              cl::desc("Reuse per-module costs keyed by file content and "
+                       "cost model"),
+              cl::value_desc("file"));
+static cl::opt<std::string>
+    DumpFile("dump-features",
+             cl::desc("Write the extracted features of every module"),
+             cl::value_desc("file"));
+static cl::opt<std::string>
+    ReplayFile("replay",
+               cl::desc("Score a feature dump instead of parsing inputdir"),
+               cl::value_desc("file"));
+static cl::opt<std::string>
+    ManifestFile("manifest",
+                 cl::desc("Read the input paths from this file (one per "
+                          "line) instead of walking inputdir"),
+                 cl::value_desc("file"));
+static cl::opt<std::string>
+    FunctionCostFile("function-costs",
+                     cl::desc("Write the cost of every function, split by "
+                              "opcode class, as a columnar table"),
+                     cl::value_desc("file"));
+static cl::opt<bool>
+    Dynamic("dynamic",
+            cl::desc("Also report costs weighted by estimated block "
+                     "frequency (one extra column per ISA)"));
+static cl::opt<bool>
+    Check("check",
+          cl::desc("Also score every function with the reference evaluator "
+                   "and fail on any difference"));
+enum class PoolScope { None, Module, Project };
+static cl::opt<PoolScope> ConstantPool(
+    "constant-pool",
+    cl::desc("Add one column per ISA with the bytes of constant-pool entries "
+             "needed by pool loads"),
+    cl::values(clEnumValN(PoolScope::Module, "module",
+                          "Each module has its own pool"),
+               clEnumValN(PoolScope::Project, "project",
+                          "Modules of a project (first path component) share "
+                          "one pool, as if linked together")),
+    cl::init(PoolScope::None));
+static cl::opt<bool>
+    DedupFiles("dedup-files",
+               cl::desc("Hash every input before parsing and parse each "
+                        "distinct content once; copies reuse its costs"));
+enum class DedupMode { None, TU, Link };
+static cl::opt<DedupMode> Dedup(
+    "dedup-functions",
+    cl::desc("Score structurally identical function bodies once"),
+    cl::values(clEnumValN(DedupMode::TU, "tu",
+                          "Charge every copy to its module"),
+               clEnumValN(DedupMode::Link, "link",
+                          "Charge linkonce_odr and weak_odr functions once "
+                          "per project (first path component), as the "
+                          "linker keeps one copy")),
+    cl::init(DedupMode::None));
+static cl::opt<bool>
+    Remat("remat",
+          cl::desc("Charge constants in every block that uses them, except "
+                   "for a few that are hoisted into registers"));
+static cl::opt<uint32_t> HoistedConstants(
+    "remat-hoisted-constants",
+    cl::desc("Constants per function kept in registers with -remat"),
+    cl::init(4), cl::value_desc("N"));
+static cl::opt<uint32_t>
+    TopN("top",
+         cl::desc("Print the N most expensive functions and opcode classes"),
+         cl::init(0), cl::value_desc("N"));
+static cl::opt<double>
+    SampleRate("sample",
+               cl::desc("Only score a random sample of this fraction of the "
+                        "inputs of each project (first path component) and "
+                        "extrapolate the totals"),
+               cl::init(0.0), cl::value_desc("fraction"));
+static cl::opt<uint32_t> SampleSeed("sample-seed",
+                                    cl::desc("Random seed of -sample"),
+                                    cl::init(0), cl::value_desc("N"));
+static cl::opt<std::string>
+    ShardSpec("shard",
+              cl::desc("Only scan shard i of N of the inputs and write "
+                       "cost.i-of-N.txt (combine them with mergeshards)"),
+              cl::value_desc("i/N"));
+
+// Bump this whenever the estimation rules change so that cached costs from
+// older builds are not reused.
+constexpr uint64_t CostModelVersion = 4;
+
+// Identifies the cost model: every immediate width, every cost constant, the
+// rule version, the rematerialization mode and whether costs are weighted by
+// block frequency.
+static uint64_t getModelFingerprint(const CostModel &Model, bool IsDynamic) {
+  SmallVector<uint64_t, 32> Params{CostModelVersion, IsDynamic, Model.Remat,
+                                   Model.HoistedConstants};
+  Model.ISA.forEachField(
+      [&](std::string_view, uint64_t Value) { Params.push_back(Value); });
+  return xxh3_64bits(ArrayRef(reinterpret_cast<const uint8_t *>(Params.data()),
+                              Params.size() * sizeof(uint64_t)));
 }
-std::set<std::string> UnsupportedIntrinsics;
 
-class CostEstimator final : public InstVisitor<CostEstimator> {
-private:
+static_assert(NumCostClasses <= 256, "cost classes are stored as uint8_t");
+
+// Cost of one function in every cost column, and the non-zero classes of its
+// static cost under the base ISA.
+struct FunctionCost {
+  std::string Name;
+  SmallVector<uint64_t, 1> Costs;
+  SmallVector<std::pair<uint8_t, uint64_t>, 4> Classes;
+};
+
+// A constant-pool entry of at most 64 bits: the constant's bits, and its size
+// in bytes plus 256 for FP constants.
+using PoolKey = std::pair<uint64_t, uint64_t>;
+
+// Scores of one function under each ISA variant.
+struct FunctionScore {
+  SmallVector<uint64_t, 1> Costs;
+  // Only filled with -dynamic.
+  SmallVector<double, 1> DynamicCosts;
+  // Pool entries loaded under each ISA, only filled with -constant-pool.
+  SmallVector<std::vector<PoolKey>, 1> Pools;
+  // Bytes of the pool loads of constants wider than 64 bits under each ISA.
+  // Features only keep the low 64 bits of a constant, so these are charged
+  // per load instead of being shared.
+  SmallVector<uint64_t, 1> UnsharedPoolBytes;
+  // Static cost under the base ISA by class, only filled if per-function
+  // costs are requested.
+  CostBreakdown Breakdown{};
+  std::set<std::string> UnsupportedIntrinsics;
+};
+
+// Costs of one module in every cost column: the static cost under each ISA
+// variant, followed by the dynamic ones with -dynamic and the constant-pool
+// bytes with -constant-pool.
+struct ModuleResult {
+  SmallVector<uint64_t, 1> Costs;
+  // Dynamic costs until they are rounded into Costs by finishModule().
+  SmallVector<double, 1> DynamicCosts;
+  std::set<std::string> UnsupportedIntrinsics;
+  // Pool entries loaded by the module under each ISA, sorted, and the bytes
+  // of its unshared entries. Only filled with -constant-pool.
+  SmallVector<std::vector<PoolKey>, 1> Pools;
+  SmallVector<uint64_t, 1> UnsharedPoolBytes;
+  // Only filled if per-function costs are requested.
+  std::vector<FunctionCost> Functions;
+};
+
+struct CachedCost {
   uint64_t Cost = 0;
-  Module &Mod;
-  Function &Func;
-  SimplifyQuery SQ;
-  SmallPtrSet<Value *, 16> RequestedValues;
-  void addOperands(Instruction &I, uint64_t K) {
-    addCost(K);
-    for (Value *V : I.operands())
-      RequestedValues.insert(V);
-  }
-  void addCost(uint64_t K = 1) { Cost += K; }
+  std::set<std::string> UnsupportedIntrinsics;
+};
+
+// On-disk map from (content hash, model fingerprint) to the module cost.
+// Each line holds the two hashes in hex, the cost and the unsupported
+// intrinsics referenced by the module.
+class CostCache final {
+  std::map<std::pair<uint64_t, uint64_t>, CachedCost> Entries;
 
 public:
-  explicit CostEstimator(Module &M, Function &F)
-      : Mod{M}, Func{F}, SQ(Mod.getDataLayout()) {}
-
-  void visitUnaryOperator(UnaryInstruction &I) {
-    assert(I.getOpcode() == Instruction::FNeg);
-    auto *Op = I.getOperand(0);
-    // match fnabs
-    match(Op, m_FAbs(m_Value(Op)));
-    RequestedValues.insert(Op);
-    addCost(FCheapOpCost);
-  }
-  void countMul(Value *LHS, Value *RHS) {
-    assert(!match(RHS, m_One()));
-    assert(!match(RHS, m_Zero()));
-
-    RequestedValues.insert(LHS);
-    if (match(RHS, m_Power2()))
-      addCost();
-    else if (match(RHS, m_Int<MulDivBits>())) {
-      addCost();
-    } else {
-      RequestedValues.insert(RHS);
-      addCost(MulCost);
+  void load(const std::string &Path) {
+    std::ifstream File(Path);
+    std::string Line;
+    while (std::getline(File, Line)) {
+      std::istringstream SS(Line);
+      uint64_t Hash, Fingerprint;
+      CachedCost Result;
+      if (!(SS >> std::hex >> Hash >> Fingerprint >> std::dec >> Result.Cost))
+        continue;
+      std::string Name;
+      while (SS >> Name)
+        Result.UnsupportedIntrinsics.insert(Name);
+      Entries[{Hash, Fingerprint}] = std::move(Result);
     }
   }
-  void countAdd(Value *LHS, Value *RHS) {
-    assert(!match(RHS, m_Zero()));
-
-    Value *X;
-    if (match(LHS, m_Shl(m_Value(X), m_ShAmt()))) {
-      RequestedValues.insert(X);
-      RequestedValues.insert(RHS);
-      addCost();
-      return;
-    }
-    if (match(RHS, m_Shl(m_Value(X), m_ShAmt()))) {
-      RequestedValues.insert(X);
-      RequestedValues.insert(LHS);
-      addCost();
-      return;
-    }
-    if (match(LHS, m_c_Mul(m_Value(X), m_UInt<SmallMulBits>()))) {
-      RequestedValues.insert(X);
-      RequestedValues.insert(RHS);
-      addCost(MulCost);
-      return;
+  bool save(const std::string &Path) const {
+    std::ofstream File(Path);
+    if (!File.is_open())
+      return false;
+    for (auto &[Key, Result] : Entries) {
+      File << std::hex << Key.first << ' ' << Key.second << std::dec << ' '
+           << Result.Cost;
+      for (auto &Name : Result.UnsupportedIntrinsics)
+        File << ' ' << Name;
+      File << '\n';
     }
-    if (match(RHS, m_c_Mul(m_Value(X), m_UInt<SmallMulBits>()))) {
-      RequestedValues.insert(X);
-      RequestedValues.insert(LHS);
-      addCost(MulCost);
-      return;
+    return true;
+  }
+  // Succeeds only if the module is cached under every fingerprint.
+  std::optional<ModuleResult> lookup(uint64_t Hash,
+                                     ArrayRef<uint64_t> Fingerprints) const {
+    ModuleResult Result;
+    for (auto Fingerprint : Fingerprints) {
+      auto It = Entries.find({Hash, Fingerprint});
+      if (It == Entries.end())
+        return std::nullopt;
+      Result.Costs.push_back(It->second.Cost);
+      Result.UnsupportedIntrinsics.insert(
+          It->second.UnsupportedIntrinsics.begin(),
+          It->second.UnsupportedIntrinsics.end());
     }
+    return Result;
+  }
+  void insert(uint64_t Hash, ArrayRef<uint64_t> Fingerprints,
+              const ModuleResult &Result) {
+    for (auto [Fingerprint, Cost] : zip(Fingerprints, Result.Costs))
+      Entries[{Hash, Fingerprint}] = {Cost, Result.UnsupportedIntrinsics};
+  }
+};
 
-    RequestedValues.insert(LHS);
-    if (!match(RHS, m_Int<AddSubImmBits>()))
-      RequestedValues.insert(RHS);
-    addCost();
+static std::vector<FunctionFeatures>
+extractModuleFeatures(Module &M, FeatureAnalyses &Analyses) {
+  std::vector<FunctionFeatures> Functions;
+  for (auto &F : M) {
+    if (!materializeBody(F))
+      continue;
+    Functions.push_back(extractFeatures(F, Analyses));
   }
-  void countMulAdd(Value *LHS, Value *RHS, Value *Add) {
-    if (match(RHS, m_Power2())) {
-      RequestedValues.insert(LHS);
-      RequestedValues.insert(Add);
-      addCost();
-      return;
-    }
+  return Functions;
+}
 
-    if (match(RHS, m_UInt<SmallMulBits>())) {
-      RequestedValues.insert(LHS);
-      RequestedValues.insert(Add);
-      addCost(MulCost);
-      return;
-    }
+static bool needFunctionCosts() {
+  return !FunctionCostFile.empty() || TopN != 0;
+}
 
-    countMul(LHS, RHS);
-    countAdd(LHS, Add);
-  }
-  void visitBinaryOperator(BinaryOperator &I) {
-    switch (I.getOpcode()) {
-    case Instruction::Add:
-      countAdd(I.getOperand(0), I.getOperand(1));
-      break;
-    case Instruction::Sub:
-      if (!match(I.getOperand(0), m_Int<AddSubImmBits>()))
-        RequestedValues.insert(I.getOperand(0));
-      RequestedValues.insert(I.getOperand(1));
-      addCost();
-      break;
-    case Instruction::AShr:
-    case Instruction::LShr: {
-      Value *V1, *V2;
-      if (match(I.getOperand(0), m_Sub(m_Value(V1), m_Value(V2))) &&
-          match(I.getOperand(1), m_ShAmt())) {
-        RequestedValues.insert(V1);
-        RequestedValues.insert(V2);
-        addCost();
-        break;
+// A dump needs the features of every module, and a per-function table,
+// -check and -constant-pool need them scored, so cached module costs are only
+// reused when none of them is requested. Module costs with link-level
+// deduplication depend on the other modules of the project.
+static bool canUseCachedCosts() {
+  return DumpFile.empty() && !needFunctionCosts() && !Check &&
+         ConstantPool == PoolScope::None && Dedup != DedupMode::Link;
+}
+
+// Functions where the evaluator and the reference evaluator disagree.
+struct CheckFailures {
+  std::mutex Lock;
+  uint64_t Count = 0;
+  // The first few of them.
+  std::vector<std::string> Names;
+};
+static CheckFailures Failures;
+
+static void checkAgainstReference(const FunctionFeatures &F,
+                                  const CostModel &Model) {
+  std::set<std::string> Intrinsics, RefIntrinsics;
+  CostBreakdown Breakdown{}, RefBreakdown{};
+  double Dynamic = 0.0, RefDynamic = 0.0;
+  uint64_t Cost = evaluateCost(F, Model, &Intrinsics, &Breakdown, &Dynamic);
+  uint64_t RefCost = evaluateCostReference(F, Model, &RefIntrinsics,
+                                           &RefBreakdown, &RefDynamic);
+  if (Cost == RefCost && Intrinsics == RefIntrinsics &&
+      Breakdown == RefBreakdown && Dynamic == RefDynamic)
+    return;
+  std::lock_guard Guard{Failures.Lock};
+  if (Failures.Count++ < 10)
+    Failures.Names.push_back(F.Name);
+}
+
+static FunctionScore scoreFunction(const FunctionFeatures &Features,
+                                   ArrayRef<CostModel> Models) {
+  FunctionScore Score;
+  bool PerFunction = needFunctionCosts();
+  bool WithPools = ConstantPool != PoolScope::None;
+  Score.DynamicCosts.assign(Dynamic ? Models.size() : 0, 0.0);
+  if (WithPools) {
+    Score.Pools.resize(Models.size());
+    Score.UnsharedPoolBytes.assign(Models.size(), 0);
+  }
+  std::vector<uint32_t> Pooled;
+  for (size_t Idx = 0; Idx < Models.size(); ++Idx) {
+    Pooled.clear();
+    Score.Costs.push_back(evaluateCost(
+        Features, Models[Idx], &Score.UnsupportedIntrinsics,
+        PerFunction && Idx == 0 ? &Score.Breakdown : nullptr,
+        Dynamic ? &Score.DynamicCosts[Idx] : nullptr,
+        WithPools ? &Pooled : nullptr));
+    for (auto Id : Pooled) {
+      auto &Info = Features.Values[Id];
+      if (Info.Bytes > sizeof(uint64_t)) {
+        Score.UnsharedPoolBytes[Idx] += Info.Bytes;
+        continue;
       }
+      bool IsFP = Info.Flags & ValueInfo::IsScalarFP;
+      Score.Pools[Idx].emplace_back(Info.SMin, Info.Bytes + (IsFP << 8));
     }
-      [[fallthrough]];
-    case Instruction::Shl:
-      if (!match(I.getOperand(0), m_Int<ShiftImmBits>()))
-        RequestedValues.insert(I.getOperand(0));
-      else if (!match(I.getOperand(1), m_ShAmt()))
-        RequestedValues.insert(I.getOperand(1));
-      addCost();
-      break;
-    case Instruction::Mul:
-      countMul(I.getOperand(0), I.getOperand(1));
-      break;
-    case Instruction::And:
-    case Instruction::Or:
-    case Instruction::Xor: {
-      auto *LHS = I.getOperand(0);
-      auto *RHS = I.getOperand(1);
-
-      // absorb not
-      if (!match(LHS, m_Not(m_Value(LHS))))
-        match(RHS, m_Not(m_Value(RHS)));
-
-      RequestedValues.insert(LHS);
-      if (!match(RHS, m_BitImm()))
-        RequestedValues.insert(RHS);
-      addCost();
-    } break;
-    case Instruction::UDiv:
-    case Instruction::URem: {
-      auto *LHS = I.getOperand(0);
-      auto *RHS = I.getOperand(1);
-      Value *V1, *V2;
-      if (match(RHS, m_UInt<SmallMulBits>()) &&
-          match(LHS, m_Sub(m_Value(V1), m_Value(V2)))) {
-        RequestedValues.insert(V1);
-        RequestedValues.insert(V2);
-      } else {
-        RequestedValues.insert(LHS);
-        if (!match(RHS, m_UInt<MulDivBits>()))
-          RequestedValues.insert(RHS);
-      }
-      addCost(DivCost);
-      break;
+    if (Check)
+      checkAgainstReference(Features, Models[Idx]);
+  }
+  return Score;
+}
+
+// A module result is started empty, gets the score of each of its functions
+// added and is then finished.
+static ModuleResult startModule(size_t NumModels) {
+  ModuleResult Result;
+  Result.Costs.assign(NumModels, 0);
+  Result.DynamicCosts.assign(Dynamic ? NumModels : 0, 0.0);
+  if (ConstantPool != PoolScope::None) {
+    Result.Pools.resize(NumModels);
+    Result.UnsharedPoolBytes.assign(NumModels, 0);
+  }
+  return Result;
+}
+
+static void addFunction(ModuleResult &Result, StringRef Name,
+                        const FunctionScore &Score) {
+  for (auto [Total, Cost] : zip(Result.Costs, Score.Costs))
+    Total += Cost;
+  for (auto [Total, Cost] : zip(Result.DynamicCosts, Score.DynamicCosts))
+    Total += Cost;
+  for (auto [Pool, Entries] : zip(Result.Pools, Score.Pools))
+    append_range(Pool, Entries);
+  for (auto [Total, Bytes] :
+       zip(Result.UnsharedPoolBytes, Score.UnsharedPoolBytes))
+    Total += Bytes;
+  Result.UnsupportedIntrinsics.insert(Score.UnsupportedIntrinsics.begin(),
+                                      Score.UnsupportedIntrinsics.end());
+  if (!needFunctionCosts())
+    return;
+  FunctionCost FC;
+  FC.Name = Name.str();
+  FC.Costs.append(Score.Costs.begin(), Score.Costs.end());
+  for (auto Cost : Score.DynamicCosts)
+    FC.Costs.push_back(std::llround(Cost));
+  for (uint32_t Class = 0; Class < NumCostClasses; ++Class)
+    if (Score.Breakdown[Class])
+      FC.Classes.emplace_back(Class, Score.Breakdown[Class]);
+  Result.Functions.push_back(std::move(FC));
+}
+
+static void finishModule(ModuleResult &Result) {
+  for (auto Cost : Result.DynamicCosts)
+    Result.Costs.push_back(std::llround(Cost));
+  for (auto &Pool : Result.Pools) {
+    llvm::sort(Pool);
+    Pool.erase(std::unique(Pool.begin(), Pool.end()), Pool.end());
+  }
+}
+
+// Scores every function of a module under each ISA variant.
+static ModuleResult evaluateModule(ArrayRef<FunctionFeatures> Functions,
+                                   ArrayRef<CostModel> Models) {
+  ModuleResult Result = startModule(Models.size());
+  for (auto &Features : Functions)
+    addFunction(Result, Features.Name, scoreFunction(Features, Models));
+  finishModule(Result);
+  return Result;
+}
+
+// Hash of everything feature extraction looks at: the body of F, the target
+// of its module, the denormal modes of F (for fcmp class tests), whether each
+// instruction is trivially dead (which depends on call attributes) and, if
+// WithFrequencies is set, the branch weights and the entry count that drive
+// block frequencies. The name of F, its other attributes and all other
+// metadata, including debug info, are left out. Unlike llvm::StructuralHash,
+// operands that are arguments, blocks or instructions are hashed by their
+// position, so that two bodies only share a hash if their data flow is the
+// same. Types and constants are hashed by their printed form, which stays
+// valid across LLVMContexts.
+static uint64_t getStructuralHash(Function &F, bool WithFrequencies) {
+  DenseMap<const Value *, uint64_t> Numbers;
+  for (auto &Arg : F.args())
+    Numbers.try_emplace(&Arg, Numbers.size());
+  for (auto &BB : F) {
+    Numbers.try_emplace(&BB, Numbers.size());
+    for (auto &I : BB)
+      Numbers.try_emplace(&I, Numbers.size());
+  }
+
+  std::string Str;
+  auto HashString = [](StringRef S) {
+    return xxh3_64bits(arrayRefFromStringRef(S));
+  };
+  auto HashPrinted = [&](auto *Entity) {
+    Str.clear();
+    raw_string_ostream OS(Str);
+    Entity->print(OS);
+    return HashString(Str);
+  };
+  DenseMap<Type *, uint64_t> TypeHashes;
+  auto HashType = [&](Type *Ty) {
+    auto [It, Inserted] = TypeHashes.try_emplace(Ty);
+    if (Inserted)
+      It->second = HashPrinted(Ty);
+    return It->second;
+  };
+
+  auto *M = F.getParent();
+  SmallVector<uint64_t, 256> Words{
+      HashString(M->getTargetTriple()), HashString(M->getDataLayoutStr()),
+      HashString(F.getFnAttribute("denormal-fp-math").getValueAsString()),
+      HashString(
+          F.getFnAttribute("denormal-fp-math-f32").getValueAsString())};
+  if (WithFrequencies) {
+    auto Count = F.getEntryCount(/*AllowSynthetic=*/true);
+    Words.append({Count.has_value(), Count ? Count->getCount() : 0,
+                  Count ? static_cast<uint64_t>(Count->getType()) : 0});
+  }
+  auto AddOperand = [&](Value *V) {
+    if (auto It = Numbers.find(V); It != Numbers.end()) {
+      Words.append({0, It->second});
+      return;
     }
-    case Instruction::SDiv:
-    case Instruction::SRem: {
-      auto *LHS = I.getOperand(0);
-      auto *RHS = I.getOperand(1);
-      Value *V1, *V2;
-      if (match(RHS, m_UInt<SmallMulBits>()) &&
-          match(LHS, m_Sub(m_Value(V1), m_Value(V2)))) {
-        RequestedValues.insert(V1);
-        RequestedValues.insert(V2);
-      } else {
-        RequestedValues.insert(LHS);
-        if (!match(RHS, m_Int<MulDivBits>()))
-          RequestedValues.insert(RHS);
+    Words.push_back(HashType(V->getType()));
+    if (auto *CI = dyn_cast<ConstantInt>(V); CI && CI->getBitWidth() <= 64)
+      Words.append({1, CI->getZExtValue()});
+    else if (auto *GV = dyn_cast<GlobalValue>(V))
+      Words.append({2, HashString(GV->getName())});
+    else if (auto *C = dyn_cast<Constant>(V))
+      Words.append({3, HashPrinted(C)});
+    else
+      Words.push_back(4);
+  };
+  for (auto &BB : F) {
+    Words.push_back(BB.size());
+    for (auto &I : BB) {
+      Words.append({I.getOpcode(), I.getRawSubclassOptionalData(),
+                    HashType(I.getType()), I.getNumOperands(),
+                    wouldInstructionBeTriviallyDead(&I)});
+      for (auto *Op : I.operand_values())
+        AddOperand(Op);
+      if (auto *Cmp = dyn_cast<CmpInst>(&I))
+        Words.push_back(Cmp->getPredicate());
+      else if (auto *GEP = dyn_cast<GetElementPtrInst>(&I))
+        Words.push_back(HashType(GEP->getSourceElementType()));
+      else if (auto *Shuffle = dyn_cast<ShuffleVectorInst>(&I))
+        append_range(Words, Shuffle->getShuffleMask());
+      else if (auto *EV = dyn_cast<ExtractValueInst>(&I))
+        append_range(Words, EV->getIndices());
+      else if (auto *IV = dyn_cast<InsertValueInst>(&I))
+        append_range(Words, IV->getIndices());
+      else if (auto *PHI = dyn_cast<PHINode>(&I))
+        for (auto *Incoming : PHI->blocks())
+          Words.push_back(Numbers.lookup(Incoming));
+      SmallVector<uint32_t, 4> Weights;
+      if (WithFrequencies && I.isTerminator() &&
+          extractBranchWeights(I, Weights)) {
+        Words.push_back(Weights.size());
+        append_range(Words, Weights);
       }
-      addCost(DivCost);
-      break;
-    }
-    case Instruction::FRem:
-      addOperands(I, GlobalCost + JumpCost);
-      break;
-    case Instruction::FDiv: {
-      auto *LHS = I.getOperand(0);
-      auto *RHS = I.getOperand(1);
-      RequestedValues.insert(LHS);
-      if (!match(RHS, m_FPImm()))
-        RequestedValues.insert(RHS);
-      addCost(FDivCost);
-      break;
-    }
-    case Instruction::FMul: {
-      auto *LHS = I.getOperand(0);
-      auto *RHS = I.getOperand(1);
-      RequestedValues.insert(LHS);
-      if (!match(RHS, m_FPImm()))
-        RequestedValues.insert(RHS);
-      addCost(FMulCost);
-      break;
-    }
-    case Instruction::FAdd:
-    case Instruction::FSub: {
-      auto *LHS = I.getOperand(0);
-      auto *RHS = I.getOperand(1);
-      if (I.getOpcode() == Instruction::FSub)
-        std::swap(LHS, RHS);
-      RequestedValues.insert(LHS);
-      if (!match(RHS, m_FPImm()))
-        RequestedValues.insert(RHS);
-      addCost(FCheapOpCost);
-      break;
-    }
-    default:
-      addOperands(I, 1);
     }
   }
-  void visitCastInst(CastInst &I) {
-    addOperands(I, I.getSrcTy()->isFPOrFPVectorTy() ||
-                           I.getDestTy()->isFPOrFPVectorTy()
-                       ? FCheapOpCost
-                       : 1);
-  }
-  void visitSExtInst(SExtInst &I) { addOperands(I, 0); }
-  void visitZExtInst(ZExtInst &I) { addOperands(I, !I.hasNonNeg()); }
-  void visitTruncInst(TruncInst &I) { addOperands(I, !I.hasNoSignedWrap()); }
-  void visitCmp(CmpInst::Predicate Pred, Value *LHS, Value *RHS) {
-    if (LHS->getType()->isFPOrFPVectorTy()) {
-      auto [V, Test] = fcmpToClassTest(Pred, Func, LHS, RHS);
-      if (!V) {
-        RequestedValues.insert(LHS);
-        if (!match(RHS, m_FPImm()))
-          RequestedValues.insert(RHS);
-      } else
-        RequestedValues.insert(V);
-      addCost(FCheapOpCost);
-    } else {
-      RequestedValues.insert(LHS);
-      if (!match(RHS, m_Int<CmpImmBits>()))
-        RequestedValues.insert(RHS);
-      addCost();
-    }
+  return xxh3_64bits(
+      ArrayRef(reinterpret_cast<const uint8_t *>(Words.data()),
+               Words.size() * sizeof(uint64_t)));
+}
+
+// Scores of the function bodies seen so far by structural hash, shared by
+// all workers.
+class ScoreMemo final {
+  std::mutex Lock;
+  DenseMap<uint64_t, std::shared_ptr<const FunctionScore>> Scores;
+
+public:
+  std::atomic<uint64_t> Lookups{0};
+  std::atomic<uint64_t> Hits{0};
+
+  std::shared_ptr<const FunctionScore> lookup(uint64_t Hash) {
+    ++Lookups;
+    std::lock_guard Guard{Lock};
+    auto Score = Scores.lookup(Hash);
+    if (Score)
+      ++Hits;
+    return Score;
   }
-  void visitCmpInst(CmpInst &I) {
-    visitCmp(I.getPredicate(), I.getOperand(0), I.getOperand(1));
-  }
-  void visitCallBase(CallBase &I) {
-    addCost(GlobalCost + JumpCost);
-    for (Value *V : I.args())
-      RequestedValues.insert(V);
-  }
-  void visitIntrinsicInst(IntrinsicInst &I) {
-    Intrinsic::ID IID = I.getIntrinsicID();
-    switch (IID) {
-    default: {
-      if (!I.isDebugOrPseudoInst() && !I.isLifetimeStartOrEnd() &&
-          I.getIntrinsicID() <= Intrinsic::xray_typedevent) {
-        UnsupportedIntrinsics.insert(
-            std::string(I.getCalledFunction()->getName()));
-        addCost(UnsupportedCost);
-        visitCallBase(I);
-      }
-      break;
-    }
-    case Intrinsic::ctlz:
-    case Intrinsic::cttz:
-    case Intrinsic::ctpop: {
-      addCost(BitCountCost);
-      RequestedValues.insert(I.getArgOperand(0));
-      break;
-    }
-    case Intrinsic::abs: {
-      // absdiff
-      Value *LHS, *RHS;
-      if (match(I.getArgOperand(0), m_Sub(m_Value(LHS), m_Value(RHS)))) {
-        RequestedValues.insert(LHS);
-        RequestedValues.insert(RHS);
-        addCost();
-        break;
-      }
+  // Keeps the first score if two workers scored the same body.
+  std::shared_ptr<const FunctionScore> insert(uint64_t Hash,
+                                              FunctionScore Score) {
+    std::lock_guard Guard{Lock};
+    auto &Entry = Scores[Hash];
+    if (!Entry)
+      Entry = std::make_shared<const FunctionScore>(std::move(Score));
+    return Entry;
+  }
+};
 
-      addCost();
-      RequestedValues.insert(I.getArgOperand(0));
-      break;
-    }
-    case Intrinsic::bswap:
-    case Intrinsic::bitreverse: {
-      addCost();
-      RequestedValues.insert(I.getArgOperand(0));
-      break;
-    }
-    case Intrinsic::smax:
-    case Intrinsic::smin:
-    case Intrinsic::umax:
-    case Intrinsic::umin: {
-      addCost();
-      RequestedValues.insert(I.getArgOperand(0));
-      if (!match(I.getArgOperand(1), m_Int<MinMaxImmBits>()))
-        RequestedValues.insert(I.getArgOperand(1));
-      break;
-    }
-    case Intrinsic::copysign: {
-      addCost(FCheapOpCost);
-      auto *Mag = I.getArgOperand(0);
-      if (!match(Mag, m_FPImm()))
-        RequestedValues.insert(Mag);
-
-      auto *Sign = I.getArgOperand(1);
-      // match fncopysign
-      match(Sign, m_FNeg(m_Value(Sign)));
-      RequestedValues.insert(Sign);
-      break;
-    }
-    case Intrinsic::fabs:
-    case Intrinsic::is_fpclass:
-    case Intrinsic::minnum:
-    case Intrinsic::maxnum:
-    case Intrinsic::minimum:
-    case Intrinsic::maximum: {
-      addCost(FCheapOpCost);
-      RequestedValues.insert(I.getArgOperand(0));
-      break;
-    }
-    case Intrinsic::sqrt: {
-      addCost(FDivCost);
-      RequestedValues.insert(I.getArgOperand(0));
-      break;
-    }
-    case Intrinsic::fma:
-    case Intrinsic::fmuladd: {
-      addCost(FMulCost);
-      RequestedValues.insert(I.getArgOperand(0));
-      RequestedValues.insert(I.getArgOperand(1));
-      RequestedValues.insert(I.getArgOperand(2));
-      break;
+// A function of a module scanned with -dedup-functions.
+struct ScoredFunction {
+  std::string Name;
+  bool IsODR;
+  std::shared_ptr<const FunctionScore> Score;
+};
+
+// Extracts and scores the functions of M whose bodies were not seen before.
+// Features are still extracted for every function if they are dumped.
+static std::vector<ScoredFunction>
+scoreModuleFunctions(Module &M, FeatureAnalyses &Analyses, ScoreMemo &Memo,
+                     ArrayRef<CostModel> Models,
+                     std::vector<FunctionFeatures> &Features) {
+  std::vector<ScoredFunction> Functions;
+  for (auto &F : M) {
+    if (!materializeBody(F))
+      continue;
+    uint64_t Hash = getStructuralHash(F, Analyses.BlockFrequencies);
+    auto Score = Memo.lookup(Hash);
+    if (!Score || !DumpFile.empty()) {
+      auto FF = extractFeatures(F, Analyses);
+      if (!Score)
+        Score = Memo.insert(Hash, scoreFunction(FF, Models));
+      if (!DumpFile.empty())
+        Features.push_back(std::move(FF));
     }
-    case Intrinsic::fshl:
-    case Intrinsic::fshr: {
-      addCost();
-      RequestedValues.insert(I.getArgOperand(0));
-      RequestedValues.insert(I.getArgOperand(1));
-      if (!match(I.getArgOperand(2), m_ShAmt()))
-        RequestedValues.insert(I.getArgOperand(2));
-      break;
+    Functions.push_back({F.getName().str(),
+                         F.hasLinkOnceODRLinkage() || F.hasWeakODRLinkage(),
+                         std::move(Score)});
+  }
+  return Functions;
+}
+
+// Appends the constant-pool bytes under each ISA to the costs of every
+// module. With project scope, an entry shared by several modules of a project
+// is charged to the first of them by name, so that the columns add up to the
+// footprint of the linked project. Unshared entries are charged to the module
+// that loads them.
+static void addPoolColumns(ArrayRef<std::string> Names,
+                           MutableArrayRef<std::optional<ModuleResult>> Results,
+                           size_t NumModels) {
+  std::vector<size_t> Order(Names.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  llvm::sort(Order, [&](size_t LHS, size_t RHS) {
+    return Names[LHS] < Names[RHS];
+  });
+  StringRef CurProject;
+  SmallVector<DenseSet<PoolKey>, 1> Seen(NumModels);
+  for (auto Idx : Order) {
+    auto &Result = Results[Idx];
+    if (!Result)
+      continue;
+    StringRef Project = StringRef(Names[Idx]).split('/').first;
+    if (ConstantPool == PoolScope::Module || Project != CurProject) {
+      for (auto &Entries : Seen)
+        Entries.clear();
+      CurProject = Project;
     }
-    case Intrinsic::sadd_sat:
-    case Intrinsic::ssub_sat:
-    case Intrinsic::sshl_sat:
-    case Intrinsic::uadd_sat:
-    case Intrinsic::usub_sat:
-    case Intrinsic::ushl_sat:
-      addOperands(I, 2);
-      break;
-    case Intrinsic::trap:
-    case Intrinsic::debugtrap:
-    case Intrinsic::assume:
-      break;
+    for (auto [Pool, Entries, Unshared] :
+         zip(Result->Pools, Seen, Result->UnsharedPoolBytes)) {
+      uint64_t Bytes = Unshared;
+      for (auto Key : Pool)
+        if (Entries.insert(Key).second)
+          Bytes += Key.second & 0xff;
+      Result->Costs.push_back(Bytes);
     }
   }
-  void visitSelectInst(SelectInst &I) {
-    Value *V1, *V2;
-    if (I.getType()->isIntegerTy(1) &&
-        match(&I, m_LogicalOp(m_Value(V1), m_Value(V2)))) {
-      RequestedValues.insert(V1);
-      RequestedValues.insert(V2);
-      addCost();
-      return;
-    }
+}
 
-    auto *LHS = I.getTrueValue();
-    auto *RHS = I.getFalseValue();
-
-    RequestedValues.insert(I.getCondition());
-    if (!match(LHS, m_Int<SelectImmBits>()))
-      RequestedValues.insert(LHS);
-    if (!match(RHS, m_Int<SelectImmBits>()))
-      RequestedValues.insert(RHS);
-    addCost();
-  }
-  void visitFreezeInst(FreezeInst &I) {
-    RequestedValues.insert(I.getOperand(0));
-  }
-  void visitReturnInst(ReturnInst &I) { addOperands(I, JumpCost); }
-  void visitLoadInst(LoadInst &I) { addOperands(I, LoadStoreCost); }
-  void visitStoreInst(StoreInst &I) { addOperands(I, LoadStoreCost); }
-  void visitAtomicCmpXchgInst(AtomicCmpXchgInst &I) {
-    addOperands(I, LoadStoreCost);
-  }
-  void visitAtomicRMWInst(AtomicRMWInst &I) { addOperands(I, LoadStoreCost); }
-  void visitFenceInst(FenceInst &I) {}
-  void visitUnreachableInst(UnreachableInst &I) {}
-  void visitBranchInst(BranchInst &I) {
-    if (I.isConditional()) {
-      if (auto *Cmp = dyn_cast<ICmpInst>(I.getCondition())) {
-        auto *LHS = Cmp->getOperand(0);
-        auto *RHS = Cmp->getOperand(1);
-        Value *X, *Y;
-        if (match(I.getCondition(), m_LogicalOp(m_Value(X), m_Value(Y)))) {
-          RequestedValues.insert(X);
-          RequestedValues.insert(Y);
-        } else
-          RequestedValues.insert(LHS);
-        if (!match(RHS, m_Int<BranchCmpImmBits>()))
-          RequestedValues.insert(RHS);
-        addCost(JumpCost);
-        return;
-      }
-      Value *X, *Y;
-      if (match(I.getCondition(), m_LogicalOp(m_Value(X), m_Value(Y)))) {
-        RequestedValues.insert(X);
-        RequestedValues.insert(Y);
-        addCost(JumpCost);
-        return;
+// Layout of the -function-costs table (see ColumnWriter); the header count is
+// the number of cost columns. Functions are numbered in module order.
+enum FunctionCostColumn : uint32_t {
+  FCModuleNames,
+  FCModuleSizes,    // functions per module
+  FCFunctionNames,
+  FCFunctionCosts,  // one cost per cost column, function-major
+  FCClassFunctions, // function number of each non-zero class entry
+  FCClassIds,       // class of the entry (uint8_t), named by FCClassNames
+  FCClassCosts,     // cost of the entry under the base ISA
+  FCClassNames,
+  NumFunctionCostColumns
+};
+
+constexpr uint32_t FunctionCostVersion = 1;
+constexpr uint32_t FunctionCostMagic = 0x43463652; // "R6FC"
+
+static bool
+writeFunctionCosts(const std::string &Path, ArrayRef<std::string> Names,
+                   ArrayRef<std::optional<ModuleResult>> Results,
+                   uint32_t NumColumns, std::string &Err) {
+  ColumnWriter<NumFunctionCostColumns> Writer;
+  uint32_t FunctionIdx = 0;
+  for (auto [Name, Result] : zip(Names, Results)) {
+    if (!Result)
+      continue;
+    Writer.putName(FCModuleNames, Name);
+    Writer.put<uint32_t>(FCModuleSizes, Result->Functions.size());
+    for (auto &FC : Result->Functions) {
+      Writer.putName(FCFunctionNames, FC.Name);
+      for (auto Cost : FC.Costs)
+        Writer.put<uint64_t>(FCFunctionCosts, Cost);
+      for (auto [Class, Cost] : FC.Classes) {
+        Writer.put<uint32_t>(FCClassFunctions, FunctionIdx);
+        Writer.put<uint8_t>(FCClassIds, Class);
+        Writer.put<uint64_t>(FCClassCosts, Cost);
       }
+      ++FunctionIdx;
     }
-    addOperands(I, JumpCost);
-  }
-  void visitSwitchInst(SwitchInst &I) {
-    // Expand to icmp + br
-    addOperands(I, JumpCost * (I.getNumCases() - I.defaultDestUndefined()));
-    for (auto &Case : I.cases())
-      visitCmp(ICmpInst::ICMP_EQ, I.getCondition(), Case.getCaseValue());
-  }
-  void visitPHINode(PHINode &PHI) {}
-  void visitIndirectBrInst(IndirectBrInst &I) { addOperands(I, JumpCost); }
-  void visitExtractValueInst(ExtractValueInst &I) {
-    const WithOverflowInst *WO;
-    if (match(&I, m_ExtractValue<0>(m_WithOverflowInst(WO)))) {
-      RequestedValues.insert(WO->getArgOperand(0));
-      RequestedValues.insert(WO->getArgOperand(1));
-      auto IID = WO->getIntrinsicID();
-      addCost(IID == Intrinsic::umul_with_overflow ||
-                      IID == Intrinsic::smul_with_overflow
-                  ? MulCost
-                  : 1);
-      return;
+  }
+  for (uint32_t Class = 0; Class < NumCostClasses; ++Class)
+    Writer.putName(FCClassNames, getCostClassName(Class));
+  return Writer.write(Path, FunctionCostMagic, FunctionCostVersion, NumColumns,
+                      Err);
+}
+
+// Prints the most expensive functions and the corpus-wide cost of the most
+// expensive opcode classes, by static cost under the base ISA.
+static void printTopCosts(ArrayRef<std::string> Names,
+                          ArrayRef<std::optional<ModuleResult>> Results,
+                          uint32_t N) {
+  std::vector<std::pair<uint64_t, const FunctionCost *>> Functions;
+  std::vector<const std::string *> Modules;
+  CostBreakdown Classes{};
+  for (auto [Name, Result] : zip(Names, Results)) {
+    if (!Result)
+      continue;
+    for (auto &FC : Result->Functions) {
+      Functions.emplace_back(FC.Costs[0], &FC);
+      Modules.push_back(&Name);
+      for (auto [Class, Cost] : FC.Classes)
+        Classes[Class] += Cost;
     }
-    if (match(&I, m_ExtractValue<1>(m_WithOverflowInst(WO)))) {
-      RequestedValues.insert(WO->getArgOperand(0));
-      RequestedValues.insert(WO->getArgOperand(1));
-      auto IID = WO->getIntrinsicID();
-      addCost(IID == Intrinsic::umul_with_overflow ||
-                      IID == Intrinsic::smul_with_overflow
-                  ? MulCost
-                  : 1);
-      return;
+  }
+  std::vector<uint32_t> Order(Functions.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  auto NumFunctions = std::min<size_t>(N, Order.size());
+  std::partial_sort(Order.begin(), Order.begin() + NumFunctions, Order.end(),
+                    [&](uint32_t LHS, uint32_t RHS) {
+                      return Functions[LHS].first > Functions[RHS].first;
+                    });
+  outs() << "Top functions:\n";
+  for (auto Idx : ArrayRef(Order).take_front(NumFunctions))
+    outs() << Functions[Idx].first << ' ' << *Modules[Idx] << ' '
+           << Functions[Idx].second->Name << '\n';
+
+  std::vector<uint32_t> ClassOrder;
+  for (uint32_t Class = 0; Class < NumCostClasses; ++Class)
+    if (Classes[Class])
+      ClassOrder.push_back(Class);
+  std::stable_sort(ClassOrder.begin(), ClassOrder.end(),
+                   [&](uint32_t LHS, uint32_t RHS) {
+                     return Classes[LHS] > Classes[RHS];
+                   });
+  outs() << "Top opcode classes:\n";
+  for (auto Class : ArrayRef(ClassOrder).take_front(N))
+    outs() << Classes[Class] << ' ' << getCostClassName(Class) << '\n';
+}
+
+// Name of an input in cost.txt: relative to the input directory, without the
+// "optimized" component. Bitcode mirrors are reported under their textual
+// names. Inputs are found under Base, so the name is taken lexically, which
+// costs no system call; only absolute manifest entries need fs::relative.
+static std::string getReportName(const fs::path &Path, const fs::path &Base) {
+  std::string_view Pattern = "/optimized/";
+  auto Name = Path.lexically_relative(Base).string();
+  if (std::error_code EC; Name.empty())
+    Name = fs::relative(Path, Base, EC).string();
+  if (auto Pos = Name.find(Pattern); Pos != std::string::npos)
+    Name.replace(Pos, Pattern.size(), "/");
+  if (Path.extension() == ".bc")
+    Name.replace(Name.size() - 3, 3, ".ll");
+  return Name;
+}
+
+// The inputs of one project and the ones drawn for -sample.
+struct Stratum {
+  size_t Population = 0;
+  std::vector<std::string> Sampled;
+};
+
+// Draws a simple random sample of every project: a fraction Rate of its
+// inputs, but at least two where there are two, so that every project gets a
+// variance estimate. Names must be sorted; the draw only depends on them and
+// on Seed. Returns the indices of the sampled names.
+static std::vector<size_t> drawSample(ArrayRef<std::string> Names,
+                                      double Rate, uint32_t Seed,
+                                      std::vector<Stratum> &Strata) {
+  std::mt19937_64 Rng{Seed};
+  std::vector<size_t> Sample;
+  for (size_t Begin = 0; Begin < Names.size();) {
+    StringRef Project = StringRef(Names[Begin]).split('/').first;
+    size_t End = Begin + 1;
+    while (End < Names.size() &&
+           StringRef(Names[End]).split('/').first == Project)
+      ++End;
+    std::vector<size_t> Members(End - Begin);
+    std::iota(Members.begin(), Members.end(), Begin);
+    size_t Size = std::clamp<size_t>(std::ceil(Rate * Members.size()),
+                                     std::min<size_t>(Members.size(), 2),
+                                     Members.size());
+    // Partial Fisher-Yates shuffle.
+    for (size_t I = 0; I < Size; ++I)
+      std::swap(Members[I], Members[I + Rng() % (Members.size() - I)]);
+    auto &S = Strata.emplace_back();
+    S.Population = Members.size();
+    for (auto Idx : ArrayRef(Members).take_front(Size)) {
+      S.Sampled.push_back(Names[Idx]);
+      Sample.push_back(Idx);
     }
+    Begin = End;
+  }
+  return Sample;
+}
 
-    addOperands(I, UnsupportedCost);
+// Stratified estimate of the corpus total of every cost column, and its
+// variance. Sampled inputs that failed to load are left out of their stratum.
+static void
+estimateTotals(ArrayRef<Stratum> Strata,
+               const std::map<std::string, ArrayRef<uint64_t>> &CostTable,
+               size_t NumColumns, SmallVectorImpl<double> &Estimate,
+               SmallVectorImpl<double> &Variance) {
+  Estimate.assign(NumColumns, 0.0);
+  Variance.assign(NumColumns, 0.0);
+  std::vector<ArrayRef<uint64_t>> Rows;
+  for (auto &S : Strata) {
+    Rows.clear();
+    for (auto &Name : S.Sampled)
+      if (auto It = CostTable.find(Name); It != CostTable.end())
+        Rows.push_back(It->second);
+    if (Rows.empty())
+      continue;
+    double Population = S.Population;
+    double Size = Rows.size();
+    for (size_t Col = 0; Col < NumColumns; ++Col) {
+      double Mean = 0.0;
+      for (auto Row : Rows)
+        Mean += Row[Col];
+      Mean /= Size;
+      double SquaredError = 0.0;
+      for (auto Row : Rows)
+        SquaredError += (Row[Col] - Mean) * (Row[Col] - Mean);
+      Estimate[Col] += Population * Mean;
+      // Variance of the stratum total, with finite population correction.
+      if (Rows.size() > 1)
+        Variance[Col] += Population * Population * (1.0 - Size / Population) *
+                         SquaredError / (Size - 1) / Size;
+    }
   }
-  void visitInsertValueInst(InsertValueInst &I) {
-    addOperands(I, UnsupportedCost);
+}
+
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "scanner\n");
+
+  if (InputDir.empty() == ReplayFile.empty()) {
+    errs() << "Expected either an input directory or -replay\n";
+    return EXIT_FAILURE;
   }
-  void visitExtractElementInst(ExtractElementInst &I) {
-    addOperands(I, UnsupportedCost);
+  if (Dedup != DedupMode::None && !ReplayFile.empty()) {
+    errs() << "-dedup-functions needs an input directory\n";
+    return EXIT_FAILURE;
   }
-  void visitInsertElementInst(InsertElementInst &I) {
-    addOperands(I, UnsupportedCost);
+  if (SampleRate < 0.0 || SampleRate > 1.0) {
+    errs() << "-sample expects a fraction between 0 and 1\n";
+    return EXIT_FAILURE;
   }
-  void visitAllocaInst(AllocaInst &I) { addOperands(I, 0); }
-  void visitGetElementPtrInst(GetElementPtrInst &I) {
-    auto &DL = Mod.getDataLayout();
-    MapVector<Value *, APInt> VariableOffsets;
-    APInt ConstantOffset = APInt::getZero(DL.getPointerSizeInBits());
-    I.collectOffset(DL, 64, VariableOffsets, ConstantOffset);
-
-    for (auto &[V, Scale] : VariableOffsets) {
-      if (Scale != 1)
-        countMulAdd(V, ConstantInt::get(I.getContext(), Scale),
-                    I.getPointerOperand());
-      else {
-        RequestedValues.insert(V);
-        addCost();
-      }
-    }
-    if (!ConstantOffset.isZero())
-      countAdd(I.getPointerOperand(),
-               ConstantInt::get(I.getContext(), ConstantOffset));
+  if (SampleRate > 0.0 && (!ReplayFile.empty() || DedupFiles)) {
+    errs() << "-sample needs an input directory and no -dedup-files\n";
+    return EXIT_FAILURE;
   }
-  void visitShuffleVectorInst(ShuffleVectorInst &I) {
-    addOperands(I, UnsupportedCost);
+  Shard Part;
+  std::string Err;
+  if (!ShardSpec.empty() && !Part.parse(ShardSpec, Err)) {
+    errs() << Err << '\n';
+    return EXIT_FAILURE;
   }
-  void visitTerminatorInst(Instruction &I) { addOperands(I, UnsupportedCost); }
-  void visitResumeInst(ResumeInst &I) { addOperands(I, UnsupportedCost); }
-  void visitLandingPadInst(LandingPadInst &I) {
-    addOperands(I, UnsupportedCost);
+  if (Part.Count > 1 && !ReplayFile.empty()) {
+    errs() << "-shard needs an input directory\n";
+    return EXIT_FAILURE;
   }
-  void visitVAArgInst(VAArgInst &I) { addOperands(I, UnsupportedCost); }
-  void visitCatchPadInst(CatchPadInst &I) { addOperands(I, UnsupportedCost); }
-  void visitCleanupPadInst(CleanupPadInst &I) {
-    addOperands(I, UnsupportedCost);
+
+  // Column 0 is the base ISA, followed by one column per -variant applied on
+  // top of it. With -dynamic, the dynamic costs follow in the same order, and
+  // with -constant-pool, the pool bytes.
+  ISAConfig BaseISA;
+  if (!ISAFile.empty() && !BaseISA.load(ISAFile, Err)) {
+    errs() << Err << '\n';
+    return EXIT_FAILURE;
   }
-  void visitFuncletPadInst(FuncletPadInst &I) {
-    addOperands(I, UnsupportedCost);
+  SmallVector<CostModel, 1> Models{CostModel{BaseISA}};
+  for (auto &Spec : Variants) {
+    ISAConfig ISA = BaseISA;
+    if (!ISA.apply(Spec, Err)) {
+      errs() << "Invalid variant '" << Spec << "': " << Err << '\n';
+      return EXIT_FAILURE;
+    }
+    Models.emplace_back(ISA);
   }
-
-  void visitInstruction(Instruction &I) {
-    errs() << I << '\n';
-    llvm_unreachable("Unhandled instruction type");
+  for (auto &Model : Models) {
+    Model.Remat = Remat;
+    Model.HoistedConstants = HoistedConstants;
   }
 
-  uint64_t run(Function &F) {
-    AssumptionCache AC(F);
-    DominatorTree DT(F);
-    DomConditionCache DC;
-    TargetLibraryInfoImpl TLI(Triple(Mod.getTargetTriple()));
-    TargetLibraryInfo TLIWrapper(TLI);
+  uint32_t NumWorkers = getNumWorkers(Jobs);
+  std::vector<Stratum> Strata;
+  std::vector<std::string> Names;
+  std::vector<std::optional<ModuleResult>> Results;
+  ProgressCounter Progress;
 
-    SQ.AC = &AC;
-    SQ.DT = &DT;
-    SQ.TLI = &TLIWrapper;
-    SQ.DC = &DC;
-
-    for (auto &BB : F) {
-      if (!DT.isReachableFromEntry(&BB))
-        continue;
-      if (auto *BI = dyn_cast<BranchInst>(BB.getTerminator());
-          BI && BI->isConditional())
-        DC.registerBranch(BI);
-      for (auto &PHI : BB.phis())
-        for (auto &V : PHI.incoming_values())
-          RequestedValues.insert(V);
+  if (!ReplayFile.empty()) {
+    std::vector<FeatureModule> Modules;
+    if (!loadFeatureDump(ReplayFile, Modules, Err)) {
+      errs() << Err << '\n';
+      return EXIT_FAILURE;
     }
-
-    for (auto BB : post_order(&F)) {
-      if (!DT.isReachableFromEntry(BB))
-        continue;
-      for (auto &I : reverse(*BB)) {
-        if (RequestedValues.contains(&I) ||
-            !wouldInstructionBeTriviallyDead(&I))
-          visit(I);
+    errs() << "Modules: " << Modules.size() << '\n';
+    Names.resize(Modules.size());
+    Results.resize(Modules.size());
+    WorkQueue Queue{Modules.size()};
+    runWorkers(NumWorkers, [&](uint32_t) {
+      size_t Idx;
+      while (Queue.pop(Idx)) {
+        Names[Idx] = Modules[Idx].Name;
+        Results[Idx] = evaluateModule(Modules[Idx].Functions, Models);
       }
+    });
+  } else {
+    SmallVector<uint64_t, 1> Fingerprints;
+    for (auto &Model : Models)
+      Fingerprints.push_back(getModelFingerprint(Model, false));
+    if (Dynamic)
+      for (auto &Model : Models)
+        Fingerprints.push_back(getModelFingerprint(Model, true));
+
+    CostCache Cache;
+    if (!CacheFile.empty())
+      Cache.load(CacheFile);
+
+    // Each worker owns its LLVMContext and keeps its own list of modules;
+    // the lists are merged and sorted by name so that the output does not
+    // depend on scheduling.
+    struct ScannedModule {
+      std::string Name;
+      uint64_t Hash = 0;
+      ModuleResult Result;
+      std::vector<FunctionFeatures> Features;
+      // With -dedup-functions, Result is summed up from Functions once all
+      // modules are scanned.
+      bool Deduped = false;
+      std::vector<ScoredFunction> Functions;
+    };
+    std::vector<std::vector<ScannedModule>> WorkerModules(NumWorkers);
+    std::atomic<uint32_t> CacheHits{0};
+    std::atomic<uint64_t> ConstantLookups{0};
+    std::atomic<uint64_t> ConstantHits{0};
+    ScoreMemo Memo;
+    // Options that look at whole projects keep each project in one shard.
+    bool ByProject = ConstantPool == PoolScope::Project ||
+                     Dedup == DedupMode::Link || SampleRate > 0.0;
+    auto Inputs =
+        openInputs(InputDir, "/optimized/", ManifestFile, Part, ByProject);
+    fs::path Base{std::string(InputDir)};
+
+    // With -dedup-files, only the first copy of each content is parsed.
+    std::vector<InputGroup> Groups;
+    if (DedupFiles) {
+      Groups = groupInputsByContent(*Inputs, NumWorkers);
+      printDedupRatio(Groups);
     }
+    WorkQueue GroupQueue{Groups.size()};
 
-    for (auto V : RequestedValues) {
-      if (auto *CI = dyn_cast<ConstantInt>(V); CI && CI->getBitWidth() <= 64) {
-        auto Val = CI->getSExtValue();
+    // With -sample, the walk is finished up front to draw the sample.
+    std::vector<fs::path> SamplePaths;
+    if (SampleRate > 0.0) {
+      std::vector<std::pair<std::string, fs::path>> Named;
+      fs::path Path;
+      while (Inputs->pop(Path))
+        Named.emplace_back(getReportName(Path, Base), std::move(Path));
+      llvm::sort(Named);
+      std::vector<std::string> SortedNames;
+      for (auto &Entry : Named)
+        SortedNames.push_back(Entry.first);
+      for (auto Idx : drawSample(SortedNames, SampleRate, SampleSeed, Strata))
+        SamplePaths.push_back(std::move(Named[Idx].second));
+      sortLargestFirst(SamplePaths, [&](const fs::path &Path) {
+        return Inputs->getSize(Path);
+      });
+      errs() << "Sample: " << SamplePaths.size() << " / " << Named.size()
+             << " inputs of " << Strata.size() << " projects\n";
+    }
+    WorkQueue SampleQueue{SamplePaths.size()};
 
-        if (isInt<LargeImmBits>(Val)) {
-          addCost();
-          continue;
+    runWorkers(NumWorkers, [&](uint32_t WorkerIdx) {
+      ContextRecycler Contexts{ModulesPerContext};
+      FeatureAnalyses Analyses;
+      // Static costs without -remat do not depend on block frequencies, but
+      // a feature dump may be replayed with -dynamic or -remat.
+      Analyses.BlockFrequencies = Dynamic || Remat || !DumpFile.empty();
+      auto &Scanned = WorkerModules[WorkerIdx];
+      const InputGroup *Group = nullptr;
+      auto Next = [&](fs::path &Path) {
+        size_t Idx;
+        if (SampleRate > 0.0) {
+          if (!SampleQueue.pop(Idx))
+            return false;
+          Path = SamplePaths[Idx];
+          if (Idx + InputFeed::ReadAhead < SamplePaths.size())
+            Inputs->prefetch(SamplePaths[Idx + InputFeed::ReadAhead]);
+          return true;
         }
-
-        if (match(CI, m_BitImm())) {
-          addCost();
+        if (!DedupFiles)
+          return Inputs->pop(Path);
+        if (!GroupQueue.pop(Idx))
+          return false;
+        Group = &Groups[Idx];
+        Path = Group->Paths.front();
+        if (Idx + InputFeed::ReadAhead < Groups.size())
+          Inputs->prefetch(Groups[Idx + InputFeed::ReadAhead].Paths.front());
+        return true;
+      };
+      // Records a module under the name of every copy of its content.
+      auto Add = [&](ScannedModule &&Module) {
+        if (Group) {
+          for (auto &Copy : drop_begin(Group->Paths)) {
+            auto &Dup = Scanned.emplace_back(Module);
+            Dup.Name = getReportName(Copy, Base);
+          }
+        }
+        Scanned.push_back(std::move(Module));
+        Progress.step();
+      };
+      fs::path Path;
+      while (Next(Path)) {
+        auto Buf = Inputs->read(Path);
+        if (!Buf)
           continue;
+        ScannedModule Module{getReportName(Path, Base)};
+        if (!CacheFile.empty()) {
+          Module.Hash = Group ? Group->Hash : hashContent(*Buf);
+          if (auto Cached = Cache.lookup(Module.Hash, Fingerprints);
+              Cached && canUseCachedCosts()) {
+            Module.Result = std::move(*Cached);
+            Add(std::move(Module));
+            ++CacheHits;
+            continue;
+          }
         }
-
-        if (isInt<LargeImmBits + AddSubImmBits>(Val)) {
-          addCost(2);
+        auto M = loadModule(std::move(Buf), Contexts.get());
+        if (!M)
           continue;
+        if (Dedup != DedupMode::None) {
+          Module.Deduped = true;
+          Module.Functions = scoreModuleFunctions(*M, Analyses, Memo, Models,
+                                                  Module.Features);
+        } else {
+          auto Functions = extractModuleFeatures(*M, Analyses);
+          Module.Result = evaluateModule(Functions, Models);
+          if (!DumpFile.empty())
+            Module.Features = std::move(Functions);
         }
-
-        addCost(LoadStoreCost);
+        Add(std::move(Module));
       }
-      if (auto *CFP = dyn_cast<ConstantFP>(V)) {
-        auto APF = CFP->getValueAPF();
-        bool loseInfo = false;
-        if (APF.convert(APFloat::IEEEhalf(), APFloat::rmNearestTiesToEven,
-                        &loseInfo) == APFloat::opOK &&
-            !loseInfo) {
-          addCost(FCheapOpCost);
+      ConstantLookups += Analyses.ConstantLookups;
+      ConstantHits += Analyses.ConstantHits;
+    });
+    errs() << '\n';
+    errs() << "Input files: " << Inputs->finish(Err) << '\n';
+    if (!Err.empty()) {
+      errs() << Err << '\n';
+      return EXIT_FAILURE;
+    }
+    if (ConstantLookups)
+      errs() << "Constant memo hits: " << ConstantHits.load() << " / "
+             << ConstantLookups.load()
+             << format(" (%.1f%%)\n",
+                       100.0 * ConstantHits.load() / ConstantLookups.load());
+
+    std::vector<ScannedModule> Modules;
+    for (auto &List : WorkerModules)
+      for (auto &Scanned : List)
+        Modules.push_back(std::move(Scanned));
+    std::sort(Modules.begin(), Modules.end(),
+              [](const ScannedModule &LHS, const ScannedModule &RHS) {
+                return LHS.Name < RHS.Name;
+              });
+
+    // With link-level accounting, an ODR function is charged to the first
+    // module of its project that defines it.
+    if (Dedup != DedupMode::None) {
+      StringRef CurProject;
+      StringSet<> Charged;
+      uint64_t Dropped = 0;
+      for (auto &Scanned : Modules) {
+        if (!Scanned.Deduped)
           continue;
+        StringRef Project = StringRef(Scanned.Name).split('/').first;
+        if (Project != CurProject) {
+          Charged.clear();
+          CurProject = Project;
         }
-
-        addCost(LoadStoreCost);
+        Scanned.Result = startModule(Models.size());
+        for (auto &F : Scanned.Functions) {
+          if (Dedup == DedupMode::Link && F.IsODR &&
+              !Charged.insert(F.Name).second) {
+            ++Dropped;
+            continue;
+          }
+          addFunction(Scanned.Result, F.Name, *F.Score);
+        }
+        finishModule(Scanned.Result);
+        Scanned.Functions.clear();
       }
+      uint64_t Lookups = Memo.Lookups.load();
+      uint64_t Hits = Memo.Hits.load();
+      errs() << "Function bodies scored: " << Lookups - Hits << " / "
+             << Lookups
+             << format(" (%.1f%% reused)\n",
+                       Lookups ? 100.0 * Hits / Lookups : 0.0);
+      if (Dedup == DedupMode::Link)
+        errs() << "Duplicate ODR functions dropped: " << Dropped << '\n';
     }
-    return Cost;
-  }
-};
-
-static uint64_t estimateCost(Module &M) {
-  uint64_t Cost = 0;
 
-  for (auto &F : M) {
-    if (F.empty())
-      continue;
-    CostEstimator Estimator{M, F};
-    Cost += Estimator.run(F);
-  }
-  return Cost;
-}
+    if (!CacheFile.empty()) {
+      errs() << "Cache hits: " << CacheHits.load() << '\n';
+      for (auto &Scanned : Modules)
+        if (Dedup != DedupMode::Link)
+          Cache.insert(Scanned.Hash, Fingerprints, Scanned.Result);
+      if (!Cache.save(CacheFile))
+        errs() << "Failed to write " << CacheFile << '\n';
+    }
 
-int main(int argc, char **argv) {
-  InitLLVM Init{argc, argv};
-  cl::ParseCommandLineOptions(argc, argv, "scanner\n");
+    if (!DumpFile.empty()) {
+      FeatureDumpWriter Writer;
+      for (auto &Scanned : Modules)
+        Writer.addModule({Scanned.Name, std::move(Scanned.Features)});
+      if (!Writer.write(DumpFile, Err))
+        errs() << Err << '\n';
+    }
 
-  std::vector<fs::path> InputFiles;
-  for (auto &Entry : fs::recursive_directory_iterator(std::string(InputDir))) {
-    if (Entry.is_regular_file()) {
-      auto &Path = Entry.path();
-      if (Path.extension() == ".ll" &&
-          Path.string().find("/optimized/") != std::string::npos)
-        InputFiles.push_back(Path);
+    for (auto &Scanned : Modules) {
+      Names.push_back(std::move(Scanned.Name));
+      Results.push_back(std::move(Scanned.Result));
     }
   }
-  errs() << "Input files: " << InputFiles.size() << '\n';
-  LLVMContext Context;
-  std::map<std::string, uint64_t> CostTable;
-  uint32_t Count = 0;
+  errs() << "Peak RSS: " << getPeakRSSInMiB() << " MiB\n";
+  if (Check) {
+    errs() << "Check: " << Failures.Count << " mismatches\n";
+    for (auto &Name : Failures.Names)
+      errs() << "  " << Name << '\n';
+  }
 
-  using namespace PatternMatch;
-  auto Base = fs::absolute(std::string(InputDir));
-  std::string_view Pattern = "/optimized/";
+  // Per-function tables only have the static and dynamic columns.
+  size_t NumFunctionColumns = Models.size() * (Dynamic ? 2 : 1);
+  if (ConstantPool != PoolScope::None)
+    addPoolColumns(Names, Results, Models.size());
 
-  for (auto &Path : InputFiles) {
-    SMDiagnostic Err;
-    auto M = parseIRFile(Path.string(), Err, Context);
-    if (!M)
+  std::map<std::string, ArrayRef<uint64_t>> CostTable;
+  std::set<std::string> UnsupportedIntrinsics;
+  for (size_t Idx = 0; Idx < Results.size(); ++Idx) {
+    if (!Results[Idx])
       continue;
-    auto Name = fs::relative(Path, Base).string();
-    Name.replace(Name.find(Pattern), Pattern.size(), "/");
-    CostTable[Name] = estimateCost(*M);
-
-    errs() << "\rProgress: " << ++Count;
+    CostTable[Names[Idx]] = Results[Idx]->Costs;
+    UnsupportedIntrinsics.insert(Results[Idx]->UnsupportedIntrinsics.begin(),
+                                 Results[Idx]->UnsupportedIntrinsics.end());
   }
-  errs() << '\n';
 
-  std::ofstream ResultFile("cost.txt");
+  std::ofstream ResultFile(Part.getOutputName("cost.txt"));
   if (!ResultFile.is_open())
     return EXIT_FAILURE;
+  if (Part.Count > 1)
+    ResultFile << Part.getHeader() << '\n';
 
-  uint64_t Sum = 0;
+  SmallVector<uint64_t, 1> Sum(
+      NumFunctionColumns +
+          (ConstantPool != PoolScope::None ? Models.size() : 0),
+      0);
   for (auto &[K, V] : CostTable) {
-    ResultFile << K << ' ' << V << '\n';
-    Sum += V;
+    ResultFile << K;
+    for (auto [Cost, Total] : zip(V, Sum)) {
+      ResultFile << ' ' << Cost;
+      Total += Cost;
+    }
+    ResultFile << '\n';
+  }
+  ResultFile << "Total";
+  for (auto Total : Sum)
+    ResultFile << ' ' << Total;
+  ResultFile << '\n';
+  // With -sample, Total only covers the sample and is followed by the
+  // extrapolated corpus totals and the half width of their 95% intervals.
+  if (SampleRate > 0.0) {
+    SmallVector<double, 1> Estimate, Variance, HalfWidth;
+    estimateTotals(Strata, CostTable, Sum.size(), Estimate, Variance);
+    for (auto V : Variance)
+      HalfWidth.push_back(1.96 * std::sqrt(V));
+    ResultFile << "Estimate";
+    for (auto Total : Estimate)
+      ResultFile << ' ' << std::llround(Total);
+    ResultFile << "\nCI95";
+    for (auto Width : HalfWidth)
+      ResultFile << ' ' << std::llround(Width);
+    ResultFile << '\n';
+    // A partial output also keeps the unrounded sums, which mergeshards adds
+    // up across the shards.
+    if (Part.Count > 1) {
+      auto Precision =
+          ResultFile.precision(std::numeric_limits<double>::max_digits10);
+      ResultFile << "EstimateSum";
+      for (auto Total : Estimate)
+        ResultFile << ' ' << Total;
+      ResultFile << "\nVariance";
+      for (auto V : Variance)
+        ResultFile << ' ' << V;
+      ResultFile << '\n';
+      ResultFile.precision(Precision);
+    }
+    if (!Estimate.empty())
+      outs() << "Estimated total: " << std::llround(Estimate[0]) << " +- "
+             << std::llround(HalfWidth[0])
+             << format(" (%.2f%%, 95%% confidence)\n",
+                       Estimate[0] ? 100.0 * HalfWidth[0] / Estimate[0]
+                                   : 0.0);
   }
-  ResultFile << "Total " << Sum << '\n';
 
   for (auto &Name : UnsupportedIntrinsics)
     ResultFile << Name << '\n';
 
-  return EXIT_SUCCESS;
+  if (!FunctionCostFile.empty() &&
+      !writeFunctionCosts(FunctionCostFile, Names, Results,
+                          NumFunctionColumns, Err))
+    errs() << Err << '\n';
+  if (TopN)
+    printTopCosts(Names, Results, TopN);
+
+  return Failures.Count ? EXIT_FAILURE : EXIT_SUCCESS;
 }
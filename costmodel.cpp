@@ -0,0 +1,1345 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include "costmodel.hpp"
+#include <llvm/ADT/APFloat.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Analysis/DomConditionCache.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/SimplifyQuery.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/InstVisitor.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PatternMatch.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <algorithm>
+#include <optional>
+
+using namespace llvm;
+using namespace PatternMatch;
+
+static auto m_BitImm() {
+  return m_CheckedInt([&](const APInt &V) {
+    if (V.getBitWidth() >= 64)
+      return false;
+    uint32_t Idx, Len;
+    if (isShiftedMask_64(V.getZExtValue(), Idx, Len) && Len <= 8)
+      return true;
+    if (V.getBitWidth() % 8 == 0 && V.isSplat(8))
+      return true;
+    if (V.countl_one() + V.countr_zero() == V.getBitWidth())
+      return true;
+    if (V.countl_zero() + V.countr_one() == V.getBitWidth())
+      return true;
+
+    return false;
+  });
+}
+
+// Cost of one lane of a vector binary operator.
+static CostKind getVectorCost(unsigned Opcode) {
+  switch (Opcode) {
+  case Instruction::Mul:
+    return CostKind::Mul;
+  case Instruction::UDiv:
+  case Instruction::URem:
+  case Instruction::SDiv:
+  case Instruction::SRem:
+    return CostKind::Div;
+  case Instruction::FRem:
+    return CostKind::Call;
+  case Instruction::FDiv:
+    return CostKind::FDiv;
+  case Instruction::FMul:
+    return CostKind::FMul;
+  case Instruction::FAdd:
+  case Instruction::FSub:
+    return CostKind::FCheapOp;
+  default:
+    return CostKind::One;
+  }
+}
+
+static auto m_FPImm() {
+  return m_CheckedFp([&](const APFloat &V) {
+    auto Val = V;
+    bool loseInfo = false;
+    return Val.convert(APFloat::Float8E4M3FN(), APFloat::rmNearestTiesToEven,
+                       &loseInfo) == APFloat::opOK &&
+           !loseInfo;
+  });
+}
+
+namespace {
+class FeatureExtractor final : public InstVisitor<FeatureExtractor> {
+private:
+  Module &Mod;
+  Function &Func;
+  SimplifyQuery SQ;
+  FunctionFeatures &Features;
+  FeatureAnalyses &FA;
+  DenseMap<Value *, uint32_t> Ids;
+  // Values that got an id but have not been described yet.
+  SmallVector<Value *, 16> Pending;
+  // The instruction being visited.
+  uint32_t CurId = 0;
+  uint8_t CurFlags = 0;
+  uint8_t CurOpcode = 0;
+  bool FirstRecord = true;
+  // Widest vector the instruction reads or writes. Its plain requests are
+  // costed per lane.
+  std::optional<VectorShape> CurShape;
+
+  uint32_t getId(Value *V) {
+    if (isa<GlobalValue>(V) || !(isa<Instruction>(V) || isa<Constant>(V)))
+      return 0;
+    auto [It, Inserted] = Ids.try_emplace(V, Features.Values.size());
+    if (Inserted) {
+      Features.Values.emplace_back();
+      Pending.push_back(V);
+    }
+    return It->second;
+  }
+  // Key of V in FeatureAnalyses::Constants, if V is a scalar constant whose
+  // description only depends on its type and value.
+  static std::optional<std::pair<uint64_t, uint64_t>> getConstantKey(Value *V) {
+    if (auto *CI = dyn_cast<ConstantInt>(V);
+        CI && CI->getType()->isIntegerTy() && CI->getBitWidth() <= 64)
+      return std::pair{CI->getZExtValue(), uint64_t{CI->getBitWidth()}};
+    if (auto *CFP = dyn_cast<ConstantFP>(V);
+        CFP && CFP->getType()->isFloatingPointTy()) {
+      APInt Bits = CFP->getValueAPF().bitcastToAPInt();
+      if (Bits.getBitWidth() <= 64)
+        return std::pair{Bits.getZExtValue(),
+                         (uint64_t{CFP->getType()->getTypeID()} + 1) << 32 |
+                             Bits.getBitWidth()};
+    }
+    return std::nullopt;
+  }
+  ValueInfo describe(Value *V) {
+    auto Key = getConstantKey(V);
+    if (!Key)
+      return describeValue(V);
+    ++FA.ConstantLookups;
+    auto [It, Inserted] = FA.Constants.try_emplace(*Key);
+    if (Inserted)
+      It->second = describeValue(V);
+    else
+      ++FA.ConstantHits;
+    return It->second;
+  }
+  ValueInfo describeValue(Value *V) {
+    ValueInfo Info;
+    if (match(V, m_Zero()))
+      Info.Flags |= ValueInfo::IsZero;
+    bool First = true;
+    if (match(V, m_CheckedInt([&](const APInt &C) {
+          if (C.getBitWidth() >= 64)
+            return false;
+          int64_t S = C.getSExtValue();
+          uint64_t U = C.getZExtValue();
+          Info.SMin = First ? S : std::min(Info.SMin, S);
+          Info.SMax = First ? S : std::max(Info.SMax, S);
+          Info.UMax = First ? U : std::max(Info.UMax, U);
+          First = false;
+          return true;
+        })))
+      Info.Flags |= ValueInfo::IsSmallInt;
+    if (match(V, m_Power2()))
+      Info.Flags |= ValueInfo::IsPower2;
+    if (auto *CI = dyn_cast<ConstantInt>(V); CI && CI->getBitWidth() <= 64) {
+      Info.Flags |= ValueInfo::IsScalarInt;
+      Info.SMin = CI->getSExtValue();
+      Info.Bytes = divideCeil(CI->getBitWidth(), 8);
+      if (match(CI, m_BitImm()))
+        Info.Flags |= ValueInfo::IsBitImm;
+    }
+    if (auto *CFP = dyn_cast<ConstantFP>(V)) {
+      Info.Flags |= ValueInfo::IsScalarFP;
+      auto APF = CFP->getValueAPF();
+      APInt Bits = APF.bitcastToAPInt();
+      Info.SMin = Bits.extractBitsAsZExtValue(
+          std::min(Bits.getBitWidth(), 64U), 0);
+      Info.Bytes = divideCeil(Bits.getBitWidth(), 8);
+      bool loseInfo = false;
+      if (APF.convert(APFloat::IEEEhalf(), APFloat::rmNearestTiesToEven,
+                      &loseInfo) == APFloat::opOK &&
+          !loseInfo)
+        Info.Flags |= ValueInfo::IsHalfFP;
+    }
+
+    Value *X, *Y;
+    if (match(V, m_Shl(m_Value(X), m_Value(Y))))
+      Info.Pattern = ValuePattern::Shl;
+    else if (match(V, m_Mul(m_Value(X), m_Value(Y))))
+      Info.Pattern = ValuePattern::Mul;
+    else if (match(V, m_Sub(m_Value(X), m_Value(Y))))
+      Info.Pattern = ValuePattern::Sub;
+    if (Info.Pattern != ValuePattern::None) {
+      Info.Op0 = getId(X);
+      Info.Op1 = getId(Y);
+    }
+    return Info;
+  }
+  // Describing a value may give ids to its pattern operands, so this runs
+  // until no value is left.
+  void describePending() {
+    while (!Pending.empty()) {
+      Value *V = Pending.pop_back_val();
+      uint32_t Id = Ids.lookup(V);
+      Features.Values[Id] = describe(V);
+    }
+  }
+
+  void emit(InstKind Kind, ArrayRef<uint32_t> Ops, uint8_t Arg = 0,
+            uint32_t Aux = 0, uint8_t Flags = 0) {
+    Flags |= CurFlags;
+    if (!FirstRecord)
+      Flags |= InstRecord::Continuation;
+    FirstRecord = false;
+    Features.Insts.push_back({CurId, Kind, Flags, Arg, CurOpcode, Aux,
+                              static_cast<uint32_t>(Features.Operands.size()),
+                              static_cast<uint32_t>(Ops.size())});
+    Features.Operands.insert(Features.Operands.end(), Ops.begin(), Ops.end());
+  }
+  void emit(InstKind Kind, std::initializer_list<Value *> Ops) {
+    SmallVector<uint32_t, 4> OpIds;
+    for (Value *V : Ops)
+      OpIds.push_back(getId(V));
+    emit(Kind, OpIds);
+  }
+  template <typename Range>
+  void request(const Range &Ops, CostKind Cost, uint32_t Mult = 1) {
+    SmallVector<uint32_t, 4> OpIds;
+    for (Value *V : Ops)
+      if (uint32_t Id = getId(V))
+        OpIds.push_back(Id);
+    if (!CurShape) {
+      emit(InstKind::Request, OpIds, static_cast<uint8_t>(Cost), Mult);
+      return;
+    }
+    for (uint32_t I = 0; I < Mult; ++I)
+      emit(InstKind::VectorOp, I ? ArrayRef<uint32_t>{} : OpIds,
+           static_cast<uint8_t>(Cost), CurShape->pack());
+  }
+  void request(std::initializer_list<Value *> Ops, CostKind Cost,
+               uint32_t Mult = 1) {
+    request<std::initializer_list<Value *>>(Ops, Cost, Mult);
+  }
+  void requestUnlessImm(Value *V, ImmField Field, bool Signed) {
+    if (uint32_t Id = getId(V))
+      emit(InstKind::RequestUnlessImm, Id, static_cast<uint8_t>(Field), 0,
+           Signed ? InstRecord::Signed : 0);
+  }
+  // Requests LHS, and RHS unless it fits an FP immediate.
+  void requestFP(Value *LHS, Value *RHS, CostKind Cost) {
+    if (match(RHS, m_FPImm()))
+      request({LHS}, Cost);
+    else
+      request({LHS, RHS}, Cost);
+  }
+  void addOperands(Instruction &I, CostKind Cost) {
+    request(I.operand_values(), Cost);
+  }
+  void emitVector(InstKind Kind, std::initializer_list<Value *> Ops,
+                  uint8_t Arg, VectorShape Shape) {
+    SmallVector<uint32_t, 4> OpIds;
+    for (Value *V : Ops)
+      if (uint32_t Id = getId(V))
+        OpIds.push_back(Id);
+    emit(Kind, OpIds, Arg, Shape.pack());
+  }
+  VectorShape getShape(VectorType *VTy) const {
+    uint64_t Lanes = VTy->getElementCount().getKnownMinValue();
+    uint64_t Bits = Mod.getDataLayout()
+                        .getTypeSizeInBits(VTy->getElementType())
+                        .getFixedValue();
+    return {static_cast<uint32_t>(std::min<uint64_t>(Lanes,
+                                                     VectorShape::MaxLanes)),
+            static_cast<uint32_t>(
+                std::clamp<uint64_t>(Bits, 1, VectorShape::MaxLaneBits))};
+  }
+  std::optional<VectorShape> getVectorShape(Instruction &I) const {
+    std::optional<VectorShape> Widest;
+    auto Visit = [&](Type *Ty) {
+      auto *VTy = dyn_cast<VectorType>(Ty);
+      if (!VTy)
+        return;
+      auto Shape = getShape(VTy);
+      if (!Widest || uint64_t{Shape.Lanes} * Shape.LaneBits >
+                         uint64_t{Widest->Lanes} * Widest->LaneBits)
+        Widest = Shape;
+    };
+    Visit(I.getType());
+    for (auto *Op : I.operand_values())
+      Visit(Op->getType());
+    return Widest;
+  }
+  // Folds the vector in the last argument of a vector.reduce intrinsic.
+  void requestReduce(IntrinsicInst &I, CostKind Cost) {
+    auto *Vec = I.getArgOperand(I.arg_size() - 1);
+    SmallVector<uint32_t, 4> OpIds;
+    for (Value *V : I.args())
+      if (uint32_t Id = getId(V))
+        OpIds.push_back(Id);
+    emit(InstKind::VectorReduce, OpIds, static_cast<uint8_t>(Cost),
+         getShape(cast<VectorType>(Vec->getType())).pack());
+  }
+
+public:
+  FeatureExtractor(Module &M, Function &F, FunctionFeatures &Features,
+                   FeatureAnalyses &FA)
+      : Mod{M}, Func{F}, SQ(Mod.getDataLayout()), Features{Features}, FA{FA} {
+    // Id 0 describes everything that is not tracked.
+    Features.Values.emplace_back();
+  }
+
+  void visitUnaryOperator(UnaryInstruction &I) {
+    assert(I.getOpcode() == Instruction::FNeg);
+    auto *Op = I.getOperand(0);
+    // match fnabs
+    if (!CurShape)
+      match(Op, m_FAbs(m_Value(Op)));
+    request({Op}, CostKind::FCheapOp);
+  }
+  void visitBinaryOperator(BinaryOperator &I) {
+    auto *LHS = I.getOperand(0);
+    auto *RHS = I.getOperand(1);
+    // Vector operands are never folded into immediates or absorbed into
+    // patterns: every lane requests all operands at the scalar op's cost.
+    // Compares, selects and the intrinsics with immediate or pattern rules
+    // follow the same rule.
+    if (CurShape) {
+      request({LHS, RHS}, getVectorCost(I.getOpcode()));
+      return;
+    }
+    switch (I.getOpcode()) {
+    case Instruction::Add:
+      emit(InstKind::Add, {LHS, RHS});
+      break;
+    case Instruction::Sub:
+      requestUnlessImm(LHS, ImmField::AddSub, /*Signed=*/true);
+      request({RHS}, CostKind::One);
+      break;
+    case Instruction::AShr:
+    case Instruction::LShr:
+      emit(InstKind::Shr, {LHS, RHS});
+      break;
+    case Instruction::Shl:
+      emit(InstKind::Shl, {LHS, RHS});
+      break;
+    case Instruction::Mul:
+      emit(InstKind::Mul, {LHS, RHS});
+      break;
+    case Instruction::And:
+    case Instruction::Or:
+    case Instruction::Xor:
+      // absorb not
+      if (!match(LHS, m_Not(m_Value(LHS))))
+        match(RHS, m_Not(m_Value(RHS)));
+
+      if (match(RHS, m_BitImm()))
+        request({LHS}, CostKind::One);
+      else
+        request({LHS, RHS}, CostKind::One);
+      break;
+    case Instruction::UDiv:
+    case Instruction::URem:
+      emit(InstKind::UDiv, {LHS, RHS});
+      break;
+    case Instruction::SDiv:
+    case Instruction::SRem:
+      emit(InstKind::SDiv, {LHS, RHS});
+      break;
+    case Instruction::FRem:
+      addOperands(I, CostKind::Call);
+      break;
+    case Instruction::FDiv:
+      requestFP(LHS, RHS, CostKind::FDiv);
+      break;
+    case Instruction::FMul:
+      requestFP(LHS, RHS, CostKind::FMul);
+      break;
+    case Instruction::FAdd:
+    case Instruction::FSub:
+      if (I.getOpcode() == Instruction::FSub)
+        std::swap(LHS, RHS);
+      requestFP(LHS, RHS, CostKind::FCheapOp);
+      break;
+    default:
+      addOperands(I, CostKind::One);
+    }
+  }
+  void visitCastInst(CastInst &I) {
+    addOperands(I, I.getSrcTy()->isFPOrFPVectorTy() ||
+                           I.getDestTy()->isFPOrFPVectorTy()
+                       ? CostKind::FCheapOp
+                       : CostKind::One);
+  }
+  void visitSExtInst(SExtInst &I) { addOperands(I, CostKind::None); }
+  void visitZExtInst(ZExtInst &I) {
+    addOperands(I, I.hasNonNeg() ? CostKind::None : CostKind::One);
+  }
+  void visitTruncInst(TruncInst &I) {
+    addOperands(I, I.hasNoSignedWrap() ? CostKind::None : CostKind::One);
+  }
+  void visitCmp(CmpInst::Predicate Pred, Value *LHS, Value *RHS) {
+    // Same rule as for vector binary operators.
+    if (CurShape) {
+      request({LHS, RHS}, LHS->getType()->isFPOrFPVectorTy()
+                              ? CostKind::FCheapOp
+                              : CostKind::One);
+      return;
+    }
+    if (LHS->getType()->isFPOrFPVectorTy()) {
+      auto [V, Test] = fcmpToClassTest(Pred, Func, LHS, RHS);
+      if (!V)
+        requestFP(LHS, RHS, CostKind::FCheapOp);
+      else
+        request({V}, CostKind::FCheapOp);
+    } else {
+      request({LHS}, CostKind::One);
+      requestUnlessImm(RHS, ImmField::Cmp, /*Signed=*/true);
+    }
+  }
+  void visitCmpInst(CmpInst &I) {
+    visitCmp(I.getPredicate(), I.getOperand(0), I.getOperand(1));
+  }
+  void visitCallBase(CallBase &I) { request(I.args(), CostKind::Call); }
+  void visitIntrinsicInst(IntrinsicInst &I) {
+    Intrinsic::ID IID = I.getIntrinsicID();
+    // Same rule as for vector binary operators.
+    if (CurShape) {
+      switch (IID) {
+      case Intrinsic::abs:
+        request({I.getArgOperand(0)}, CostKind::One);
+        return;
+      case Intrinsic::smax:
+      case Intrinsic::smin:
+      case Intrinsic::umax:
+      case Intrinsic::umin:
+        request({I.getArgOperand(0), I.getArgOperand(1)}, CostKind::One);
+        return;
+      case Intrinsic::fshl:
+      case Intrinsic::fshr:
+        request(I.args(), CostKind::One);
+        return;
+      case Intrinsic::copysign:
+        request(I.args(), CostKind::FCheapOp);
+        return;
+      default:
+        break;
+      }
+    }
+    switch (IID) {
+    default: {
+      if (!I.isDebugOrPseudoInst() && !I.isLifetimeStartOrEnd() &&
+          I.getIntrinsicID() <= Intrinsic::xray_typedevent) {
+        emit(InstKind::UnsupportedIntrinsic, {}, 0,
+             static_cast<uint32_t>(Features.Intrinsics.size()));
+        Features.Intrinsics.emplace_back(I.getCalledFunction()->getName());
+        CurShape.reset();
+        visitCallBase(I);
+      }
+      break;
+    }
+    case Intrinsic::ctlz:
+    case Intrinsic::cttz:
+    case Intrinsic::ctpop:
+      request({I.getArgOperand(0)}, CostKind::BitCount);
+      break;
+    case Intrinsic::abs: {
+      // absdiff
+      Value *LHS, *RHS;
+      if (match(I.getArgOperand(0), m_Sub(m_Value(LHS), m_Value(RHS))))
+        request({LHS, RHS}, CostKind::One);
+      else
+        request({I.getArgOperand(0)}, CostKind::One);
+      break;
+    }
+    case Intrinsic::bswap:
+    case Intrinsic::bitreverse:
+      request({I.getArgOperand(0)}, CostKind::One);
+      break;
+    case Intrinsic::smax:
+    case Intrinsic::smin:
+    case Intrinsic::umax:
+    case Intrinsic::umin:
+      request({I.getArgOperand(0)}, CostKind::One);
+      requestUnlessImm(I.getArgOperand(1), ImmField::MinMax,
+                       /*Signed=*/true);
+      break;
+    case Intrinsic::copysign: {
+      auto *Mag = I.getArgOperand(0);
+      auto *Sign = I.getArgOperand(1);
+      // match fncopysign
+      match(Sign, m_FNeg(m_Value(Sign)));
+      if (match(Mag, m_FPImm()))
+        request({Sign}, CostKind::FCheapOp);
+      else
+        request({Mag, Sign}, CostKind::FCheapOp);
+      break;
+    }
+    case Intrinsic::fabs:
+    case Intrinsic::is_fpclass:
+    case Intrinsic::minnum:
+    case Intrinsic::maxnum:
+    case Intrinsic::minimum:
+    case Intrinsic::maximum:
+      request({I.getArgOperand(0)}, CostKind::FCheapOp);
+      break;
+    case Intrinsic::sqrt:
+      request({I.getArgOperand(0)}, CostKind::FDiv);
+      break;
+    case Intrinsic::fma:
+    case Intrinsic::fmuladd:
+      request({I.getArgOperand(0), I.getArgOperand(1), I.getArgOperand(2)},
+              CostKind::FMul);
+      break;
+    case Intrinsic::fshl:
+    case Intrinsic::fshr:
+      request({I.getArgOperand(0), I.getArgOperand(1)}, CostKind::One);
+      requestUnlessImm(I.getArgOperand(2), ImmField::ShAmt,
+                       /*Signed=*/false);
+      break;
+    case Intrinsic::sadd_sat:
+    case Intrinsic::ssub_sat:
+    case Intrinsic::sshl_sat:
+    case Intrinsic::uadd_sat:
+    case Intrinsic::usub_sat:
+    case Intrinsic::ushl_sat:
+      request(I.operand_values(), CostKind::One, 2);
+      break;
+    case Intrinsic::vector_reduce_add:
+    case Intrinsic::vector_reduce_and:
+    case Intrinsic::vector_reduce_or:
+    case Intrinsic::vector_reduce_xor:
+    case Intrinsic::vector_reduce_smax:
+    case Intrinsic::vector_reduce_smin:
+    case Intrinsic::vector_reduce_umax:
+    case Intrinsic::vector_reduce_umin:
+      requestReduce(I, CostKind::One);
+      break;
+    case Intrinsic::vector_reduce_mul:
+      requestReduce(I, CostKind::Mul);
+      break;
+    case Intrinsic::vector_reduce_fadd:
+    case Intrinsic::vector_reduce_fmax:
+    case Intrinsic::vector_reduce_fmin:
+    case Intrinsic::vector_reduce_fmaximum:
+    case Intrinsic::vector_reduce_fminimum:
+      requestReduce(I, CostKind::FCheapOp);
+      break;
+    case Intrinsic::vector_reduce_fmul:
+      requestReduce(I, CostKind::FMul);
+      break;
+    case Intrinsic::trap:
+    case Intrinsic::debugtrap:
+    case Intrinsic::assume:
+      break;
+    }
+  }
+  void visitSelectInst(SelectInst &I) {
+    Value *V1, *V2;
+    if (I.getType()->isIntegerTy(1) &&
+        match(&I, m_LogicalOp(m_Value(V1), m_Value(V2)))) {
+      request({V1, V2}, CostKind::One);
+      return;
+    }
+
+    // Same rule as for vector binary operators.
+    if (CurShape) {
+      request(I.operand_values(), CostKind::One);
+      return;
+    }
+
+    request({I.getCondition()}, CostKind::One);
+    requestUnlessImm(I.getTrueValue(), ImmField::Select, /*Signed=*/true);
+    requestUnlessImm(I.getFalseValue(), ImmField::Select, /*Signed=*/true);
+  }
+  void visitFreezeInst(FreezeInst &I) {
+    request({I.getOperand(0)}, CostKind::None);
+  }
+  void visitReturnInst(ReturnInst &I) { addOperands(I, CostKind::Jump); }
+  void visitLoadInst(LoadInst &I) { addOperands(I, CostKind::LoadStore); }
+  void visitStoreInst(StoreInst &I) { addOperands(I, CostKind::LoadStore); }
+  void visitAtomicCmpXchgInst(AtomicCmpXchgInst &I) {
+    addOperands(I, CostKind::LoadStore);
+  }
+  void visitAtomicRMWInst(AtomicRMWInst &I) {
+    addOperands(I, CostKind::LoadStore);
+  }
+  void visitFenceInst(FenceInst &I) {}
+  void visitUnreachableInst(UnreachableInst &I) {}
+  void visitBranchInst(BranchInst &I) {
+    if (I.isConditional()) {
+      if (auto *Cmp = dyn_cast<ICmpInst>(I.getCondition())) {
+        auto *LHS = Cmp->getOperand(0);
+        auto *RHS = Cmp->getOperand(1);
+        Value *X, *Y;
+        if (match(I.getCondition(), m_LogicalOp(m_Value(X), m_Value(Y))))
+          request({X, Y}, CostKind::Jump);
+        else
+          request({LHS}, CostKind::Jump);
+        requestUnlessImm(RHS, ImmField::BranchCmp, /*Signed=*/true);
+        return;
+      }
+      Value *X, *Y;
+      if (match(I.getCondition(), m_LogicalOp(m_Value(X), m_Value(Y)))) {
+        request({X, Y}, CostKind::Jump);
+        return;
+      }
+    }
+    addOperands(I, CostKind::Jump);
+  }
+  void visitSwitchInst(SwitchInst &I) {
+    // Expand to icmp + br
+    request(I.operand_values(), CostKind::Jump,
+            I.getNumCases() - I.defaultDestUndefined());
+    for (auto &Case : I.cases())
+      visitCmp(ICmpInst::ICMP_EQ, I.getCondition(), Case.getCaseValue());
+  }
+  void visitPHINode(PHINode &PHI) {}
+  void visitIndirectBrInst(IndirectBrInst &I) {
+    addOperands(I, CostKind::Jump);
+  }
+  void visitExtractValueInst(ExtractValueInst &I) {
+    const WithOverflowInst *WO;
+    if (match(&I, m_ExtractValue<0>(m_WithOverflowInst(WO))) ||
+        match(&I, m_ExtractValue<1>(m_WithOverflowInst(WO)))) {
+      auto IID = WO->getIntrinsicID();
+      request({WO->getArgOperand(0), WO->getArgOperand(1)},
+              IID == Intrinsic::umul_with_overflow ||
+                      IID == Intrinsic::smul_with_overflow
+                  ? CostKind::Mul
+                  : CostKind::One);
+      return;
+    }
+
+    addOperands(I, CostKind::Unsupported);
+  }
+  void visitInsertValueInst(InsertValueInst &I) {
+    addOperands(I, CostKind::Unsupported);
+  }
+  void visitExtractElementInst(ExtractElementInst &I) {
+    auto *Vec = I.getVectorOperand();
+    auto *Idx = I.getIndexOperand();
+    auto Shape = getShape(I.getVectorOperandType());
+    if (isa<ConstantInt>(Idx))
+      emitVector(InstKind::VectorLane, {Vec},
+                 static_cast<uint8_t>(LaneAccess::Extract), Shape);
+    else
+      emitVector(InstKind::VectorLane, {Vec, Idx},
+                 static_cast<uint8_t>(LaneAccess::ExtractVariable), Shape);
+  }
+  void visitInsertElementInst(InsertElementInst &I) {
+    auto *Vec = I.getOperand(0);
+    auto *Elt = I.getOperand(1);
+    auto *Idx = I.getOperand(2);
+    auto Shape = getShape(I.getType());
+    if (isa<ConstantInt>(Idx))
+      emitVector(InstKind::VectorLane, {Vec, Elt},
+                 static_cast<uint8_t>(LaneAccess::Insert), Shape);
+    else
+      emitVector(InstKind::VectorLane, {Vec, Elt, Idx},
+                 static_cast<uint8_t>(LaneAccess::InsertVariable), Shape);
+  }
+  void visitAllocaInst(AllocaInst &I) { addOperands(I, CostKind::None); }
+  void visitGetElementPtrInst(GetElementPtrInst &I) {
+    auto &DL = Mod.getDataLayout();
+    MapVector<Value *, APInt> VariableOffsets;
+    APInt ConstantOffset = APInt::getZero(DL.getPointerSizeInBits());
+    I.collectOffset(DL, 64, VariableOffsets, ConstantOffset);
+
+    for (auto &[V, Scale] : VariableOffsets) {
+      if (Scale != 1)
+        emit(InstKind::MulAdd, {V, ConstantInt::get(I.getContext(), Scale),
+                                I.getPointerOperand()});
+      else
+        request({V}, CostKind::One);
+    }
+    if (!ConstantOffset.isZero())
+      emit(InstKind::Add, {I.getPointerOperand(),
+                           ConstantInt::get(I.getContext(), ConstantOffset)});
+  }
+  void visitShuffleVectorInst(ShuffleVectorInst &I) {
+    // Lanes that stay in place are free, every other one is a move.
+    auto Mask = I.getShuffleMask();
+    auto Shape = getShape(I.getType());
+    Shape.Lanes = 0;
+    for (uint32_t Idx = 0; Idx < Mask.size(); ++Idx)
+      if (Mask[Idx] != PoisonMaskElem && Mask[Idx] != static_cast<int>(Idx))
+        ++Shape.Lanes;
+    emitVector(InstKind::VectorOp, {I.getOperand(0), I.getOperand(1)},
+               static_cast<uint8_t>(CostKind::One), Shape);
+  }
+  void visitTerminatorInst(Instruction &I) {
+    addOperands(I, CostKind::Unsupported);
+  }
+  void visitResumeInst(ResumeInst &I) {
+    addOperands(I, CostKind::Unsupported);
+  }
+  void visitLandingPadInst(LandingPadInst &I) {
+    addOperands(I, CostKind::Unsupported);
+  }
+  void visitVAArgInst(VAArgInst &I) { addOperands(I, CostKind::Unsupported); }
+  void visitCatchPadInst(CatchPadInst &I) {
+    addOperands(I, CostKind::Unsupported);
+  }
+  void visitCleanupPadInst(CleanupPadInst &I) {
+    addOperands(I, CostKind::Unsupported);
+  }
+  void visitFuncletPadInst(FuncletPadInst &I) {
+    addOperands(I, CostKind::Unsupported);
+  }
+
+  void visitInstruction(Instruction &I) {
+    errs() << I << '\n';
+    llvm_unreachable("Unhandled instruction type");
+  }
+
+  void run(Function &F, AssumptionCache &AC, DominatorTree &DT,
+           const TargetLibraryInfo &TLI, BlockFrequencyInfo *BFI) {
+    DomConditionCache DC;
+    SQ.AC = &AC;
+    SQ.DT = &DT;
+    SQ.TLI = &TLI;
+    SQ.DC = &DC;
+
+    for (auto &BB : F) {
+      if (!DT.isReachableFromEntry(&BB))
+        continue;
+      if (auto *BI = dyn_cast<BranchInst>(BB.getTerminator());
+          BI && BI->isConditional())
+        DC.registerBranch(BI);
+      for (auto &PHI : BB.phis())
+        for (auto &V : PHI.incoming_values())
+          if (uint32_t Id = getId(V))
+            Features.PhiUses.push_back(Id);
+    }
+
+    SmallVector<BasicBlock *, 16> Order;
+    DenseMap<BasicBlock *, uint32_t> BlockIds;
+    for (auto BB : post_order(&F)) {
+      if (!DT.isReachableFromEntry(BB))
+        continue;
+      BlockIds[BB] = Order.size();
+      Order.push_back(BB);
+    }
+
+    double EntryFreq = BFI ? BFI->getEntryFreq().getFrequency() : 1.0;
+    for (uint32_t Idx = 0; Idx < Order.size(); ++Idx) {
+      auto *BB = Order[Idx];
+      auto *IDom = DT.getNode(BB)->getIDom();
+      Features.Blocks.push_back(
+          {static_cast<uint32_t>(Features.Insts.size()),
+           BFI ? BFI->getBlockFreq(BB).getFrequency() / EntryFreq : 1.0,
+           IDom ? BlockIds.lookup(IDom->getBlock()) : Idx});
+      for (auto &I : reverse(*BB)) {
+        CurId = getId(&I);
+        CurFlags = wouldInstructionBeTriviallyDead(&I) ? InstRecord::Dead : 0;
+        CurOpcode = I.getOpcode();
+        FirstRecord = true;
+        // Calls and terminators cost the same for vectors.
+        if (I.isTerminator() ||
+            (isa<CallBase>(I) && !isa<IntrinsicInst>(I)))
+          CurShape.reset();
+        else
+          CurShape = getVectorShape(I);
+        visit(I);
+      }
+    }
+    describePending();
+  }
+};
+
+// With UseTable, the immediate fields and fused patterns every value matches
+// are classified once up front, so that each rule is a few bit tests on its
+// operands. Without it, every check is computed when a rule asks for it; that
+// form is kept as the reference for -check.
+template <bool UseTable> class CostEvaluator final {
+  const FunctionFeatures &Features;
+  const ISAConfig &ISA;
+  const ISARanges &Imm;
+  bool Remat;
+  uint32_t HoistedConstants;
+  std::set<std::string> *UnsupportedIntrinsics;
+  CostBreakdown *Breakdown;
+  uint64_t Cost = 0;
+  double DynamicCost = 0.0;
+  // Class and block frequency the next addCost() is charged to.
+  uint32_t CurClass = 0;
+  double CurFreq = 1.0;
+  // Block of the record being applied. PHI uses count as uses in the entry
+  // block.
+  uint32_t CurBlock = 0;
+  // Shape of each value, see classify().
+  std::vector<uint32_t> Shapes;
+  // Indexed by value id.
+  BitVector RequestedValues;
+  // Requested values that are materialized if they are constants.
+  SmallVector<uint32_t, 16> RequestedConstants;
+  // Blocks that use each requested constant, only tracked with Remat.
+  DenseMap<uint32_t, SmallVector<uint32_t, 2>> ConstantUses;
+
+  void addCost(uint64_t K = 1) {
+    Cost += K;
+    DynamicCost += K * CurFreq;
+    if (Breakdown)
+      (*Breakdown)[CurClass] += K;
+  }
+  void request(uint32_t Id) {
+    bool IsConstant =
+        getInfo(Id).Flags & (ValueInfo::IsScalarInt | ValueInfo::IsScalarFP);
+    if (IsConstant && Remat && !Features.Blocks.empty()) {
+      auto &Uses = ConstantUses[Id];
+      if (Uses.empty() || Uses.back() != CurBlock)
+        Uses.push_back(CurBlock);
+    }
+    if (RequestedValues.test(Id))
+      return;
+    RequestedValues.set(Id);
+    if (IsConstant)
+      RequestedConstants.push_back(Id);
+  }
+
+  // Cost of materializing a requested constant once. Pooled is set if the
+  // constant is loaded from a constant pool.
+  uint64_t getMaterializationCost(const ValueInfo &Info, bool &Pooled) const {
+    Pooled = false;
+    if (Info.Flags & ValueInfo::IsScalarInt) {
+      auto Val = Info.SMin;
+      if (Imm.LargeImmBits.fitsSigned(Val))
+        return 1;
+      if (Info.Flags & ValueInfo::IsBitImm)
+        return 1;
+      if (Imm.LargeAddSubImmBits.fitsSigned(Val))
+        return 2;
+      Pooled = true;
+      return ISA.LoadStoreCost;
+    }
+    if (Info.Flags & ValueInfo::IsHalfFP)
+      return ISA.FCheapOpCost;
+    Pooled = true;
+    return ISA.LoadStoreCost;
+  }
+
+  // The coldest block that dominates every block of Uses.
+  uint32_t getHoistBlock(ArrayRef<uint32_t> Uses) const {
+    auto &Blocks = Features.Blocks;
+    uint32_t Dom = Uses.front();
+    for (auto Use : Uses.drop_front()) {
+      while (Dom != Use) {
+        if (Dom < Use)
+          Dom = Blocks[Dom].IDom;
+        else
+          Use = Blocks[Use].IDom;
+      }
+    }
+    uint32_t Coldest = Dom;
+    while (Blocks[Dom].IDom != Dom) {
+      Dom = Blocks[Dom].IDom;
+      if (Blocks[Dom].Freq < Blocks[Coldest].Freq)
+        Coldest = Dom;
+    }
+    return Coldest;
+  }
+
+  // Lanes of a scalarized vector, or the vector registers it takes up.
+  uint64_t getVectorUnits(VectorShape Shape) const {
+    if (!ISA.VectorBits)
+      return Shape.Lanes;
+    return divideCeil(uint64_t{Shape.Lanes} * Shape.LaneBits, ISA.VectorBits);
+  }
+
+  // A constant that may be kept in a register instead of being
+  // rematerialized in each of its Uses.
+  struct HoistCandidate {
+    uint32_t Id;
+    uint64_t Unit;
+    uint32_t Home;
+    const SmallVector<uint32_t, 2> *Uses;
+    double Savings;
+  };
+
+  uint64_t getCost(CostKind Kind) const {
+    switch (Kind) {
+    case CostKind::None:
+      return 0;
+    case CostKind::One:
+      return 1;
+    case CostKind::LoadStore:
+      return ISA.LoadStoreCost;
+    case CostKind::Jump:
+      return ISA.JumpCost;
+    case CostKind::Mul:
+      return ISA.MulCost;
+    case CostKind::Div:
+      return ISA.DivCost;
+    case CostKind::FDiv:
+      return ISA.FDivCost;
+    case CostKind::FMul:
+      return ISA.FMulCost;
+    case CostKind::FCheapOp:
+      return ISA.FCheapOpCost;
+    case CostKind::Call:
+      return ISA.GlobalCost + ISA.JumpCost;
+    case CostKind::BitCount:
+      return ISA.BitCountCost;
+    case CostKind::Unsupported:
+      return ISA.UnsupportedCost;
+    }
+    llvm_unreachable("Unknown cost kind");
+  }
+  const ImmRange &getRange(ImmField Field) const {
+    switch (Field) {
+    case ImmField::ShAmt:
+      return Imm.ShAmtBits;
+    case ImmField::AddSub:
+      return Imm.AddSubImmBits;
+    case ImmField::ShiftImm:
+      return Imm.ShiftImmBits;
+    case ImmField::MulDiv:
+      return Imm.MulDivBits;
+    case ImmField::SmallMul:
+      return Imm.SmallMulBits;
+    case ImmField::Cmp:
+      return Imm.CmpImmBits;
+    case ImmField::MinMax:
+      return Imm.MinMaxImmBits;
+    case ImmField::Select:
+      return Imm.SelectImmBits;
+    case ImmField::BranchCmp:
+      return Imm.BranchCmpImmBits;
+    }
+    llvm_unreachable("Unknown immediate field");
+  }
+  const ValueInfo &getInfo(uint32_t Id) const { return Features.Values[Id]; }
+
+  // Shape bits of a value under the ISA: bit 2 * Field + Unsigned is set if
+  // the value fits the immediate field, followed by the fused patterns.
+  enum : uint32_t {
+    ShlByImm = 1U << (2 * NumImmFields),
+    SmallMulByOp0 = ShlByImm << 1,
+    SmallMulByOp1 = ShlByImm << 2,
+  };
+  static constexpr uint32_t getFitBit(ImmField Field, bool Signed) {
+    return 1U << (2 * static_cast<uint32_t>(Field) + !Signed);
+  }
+  bool fitsDirect(uint32_t Id, ImmField Field, bool Signed) const {
+    auto &Info = getInfo(Id);
+    if (Info.Flags & ValueInfo::IsZero)
+      return true;
+    if (!(Info.Flags & ValueInfo::IsSmallInt))
+      return false;
+    auto &Range = getRange(Field);
+    return Signed ? Range.fitsSigned(Info.SMin) && Range.fitsSigned(Info.SMax)
+                  : Range.fitsUnsigned(Info.UMax);
+  }
+  uint32_t classify(uint32_t Id) const {
+    auto &Info = getInfo(Id);
+    uint32_t Shape = 0;
+    if (Info.Flags & (ValueInfo::IsZero | ValueInfo::IsSmallInt))
+      for (uint32_t Field = 0; Field < NumImmFields; ++Field)
+        for (bool Signed : {false, true})
+          if (fitsDirect(Id, static_cast<ImmField>(Field), Signed))
+            Shape |= getFitBit(static_cast<ImmField>(Field), Signed);
+    // m_Shl(m_Value(X), m_UInt(ShAmtBits))
+    if (Info.Pattern == ValuePattern::Shl &&
+        fitsDirect(Info.Op1, ImmField::ShAmt, false))
+      Shape |= ShlByImm;
+    // m_c_Mul(m_Value(X), m_UInt(SmallMulBits))
+    if (Info.Pattern == ValuePattern::Mul) {
+      if (fitsDirect(Info.Op1, ImmField::SmallMul, false))
+        Shape |= SmallMulByOp1;
+      if (fitsDirect(Info.Op0, ImmField::SmallMul, false))
+        Shape |= SmallMulByOp0;
+    }
+    return Shape;
+  }
+  bool fits(uint32_t Id, ImmField Field, bool Signed) const {
+    return UseTable ? Shapes[Id] & getFitBit(Field, Signed)
+                    : fitsDirect(Id, Field, Signed);
+  }
+  bool fitsInt(uint32_t Id, ImmField Field) const {
+    return fits(Id, Field, true);
+  }
+  bool fitsUInt(uint32_t Id, ImmField Field) const {
+    return fits(Id, Field, false);
+  }
+  bool isPower2(uint32_t Id) const {
+    return getInfo(Id).Flags & ValueInfo::IsPower2;
+  }
+  bool matchShlByImm(uint32_t Id, uint32_t &X) const {
+    auto &Info = getInfo(Id);
+    if (Info.Pattern != ValuePattern::Shl)
+      return false;
+    if (UseTable ? !(Shapes[Id] & ShlByImm)
+                 : !fitsDirect(Info.Op1, ImmField::ShAmt, false))
+      return false;
+    X = Info.Op0;
+    return true;
+  }
+  bool matchSmallMul(uint32_t Id, uint32_t &X) const {
+    auto &Info = getInfo(Id);
+    if (Info.Pattern != ValuePattern::Mul)
+      return false;
+    if (UseTable ? Shapes[Id] & SmallMulByOp1
+                 : fitsDirect(Info.Op1, ImmField::SmallMul, false)) {
+      X = Info.Op0;
+      return true;
+    }
+    if (UseTable ? Shapes[Id] & SmallMulByOp0
+                 : fitsDirect(Info.Op0, ImmField::SmallMul, false)) {
+      X = Info.Op1;
+      return true;
+    }
+    return false;
+  }
+
+  void countMul(uint32_t LHS, uint32_t RHS) {
+    request(LHS);
+    if (isPower2(RHS))
+      addCost();
+    else if (fitsInt(RHS, ImmField::MulDiv)) {
+      addCost();
+    } else {
+      request(RHS);
+      addCost(ISA.MulCost);
+    }
+  }
+  void countAdd(uint32_t LHS, uint32_t RHS) {
+    uint32_t X;
+    if (matchShlByImm(LHS, X)) {
+      request(X);
+      request(RHS);
+      addCost();
+      return;
+    }
+    if (matchShlByImm(RHS, X)) {
+      request(X);
+      request(LHS);
+      addCost();
+      return;
+    }
+    if (matchSmallMul(LHS, X)) {
+      request(X);
+      request(RHS);
+      addCost(ISA.MulCost);
+      return;
+    }
+    if (matchSmallMul(RHS, X)) {
+      request(X);
+      request(LHS);
+      addCost(ISA.MulCost);
+      return;
+    }
+
+    request(LHS);
+    if (!fitsInt(RHS, ImmField::AddSub))
+      request(RHS);
+    addCost();
+  }
+  void countMulAdd(uint32_t LHS, uint32_t RHS, uint32_t Add) {
+    if (isPower2(RHS)) {
+      request(LHS);
+      request(Add);
+      addCost();
+      return;
+    }
+
+    if (fitsUInt(RHS, ImmField::SmallMul)) {
+      request(LHS);
+      request(Add);
+      addCost(ISA.MulCost);
+      return;
+    }
+
+    countMul(LHS, RHS);
+    countAdd(LHS, Add);
+  }
+  void countDiv(uint32_t LHS, uint32_t RHS, bool Signed) {
+    auto &Info = getInfo(LHS);
+    if (fitsUInt(RHS, ImmField::SmallMul) &&
+        Info.Pattern == ValuePattern::Sub) {
+      request(Info.Op0);
+      request(Info.Op1);
+    } else {
+      request(LHS);
+      if (!fits(RHS, ImmField::MulDiv, Signed))
+        request(RHS);
+    }
+    addCost(ISA.DivCost);
+  }
+
+  void apply(const InstRecord &R) {
+    ArrayRef<uint32_t> Ops{Features.Operands.data() + R.FirstOp, R.NumOps};
+    switch (R.Kind) {
+    case InstKind::Request:
+      for (auto Id : Ops)
+        request(Id);
+      addCost(getCost(static_cast<CostKind>(R.Arg)) * R.Aux);
+      break;
+    case InstKind::RequestUnlessImm:
+      if (!fits(Ops[0], static_cast<ImmField>(R.Arg),
+                R.Flags & InstRecord::Signed))
+        request(Ops[0]);
+      break;
+    case InstKind::UnsupportedIntrinsic:
+      if (UnsupportedIntrinsics)
+        UnsupportedIntrinsics->insert(Features.Intrinsics[R.Aux]);
+      addCost(ISA.UnsupportedCost);
+      break;
+    case InstKind::VectorOp:
+      for (auto Id : Ops)
+        request(Id);
+      addCost(getCost(static_cast<CostKind>(R.Arg)) *
+              getVectorUnits(VectorShape::unpack(R.Aux)));
+      break;
+    case InstKind::VectorReduce: {
+      for (auto Id : Ops)
+        request(Id);
+      auto Shape = VectorShape::unpack(R.Aux);
+      uint64_t Step = getCost(static_cast<CostKind>(R.Arg));
+      if (!ISA.VectorBits) {
+        addCost(Step * (Shape.Lanes - 1));
+        break;
+      }
+      // Fold the registers into one, then halve it with a permute and a step
+      // until one lane is left.
+      uint64_t LanesPerReg =
+          std::max<uint64_t>(ISA.VectorBits / Shape.LaneBits, 1);
+      addCost(Step * (getVectorUnits(Shape) - 1) +
+              (Step + 1) *
+                  Log2_64_Ceil(std::min<uint64_t>(Shape.Lanes, LanesPerReg)));
+      break;
+    }
+    case InstKind::VectorLane: {
+      for (auto Id : Ops)
+        request(Id);
+      auto Access = static_cast<LaneAccess>(R.Arg);
+      bool Variable = Access == LaneAccess::ExtractVariable ||
+                      Access == LaneAccess::InsertVariable;
+      // A vector extension moves a lane with one instruction, after sliding
+      // it into place if the index is variable.
+      if (ISA.VectorBits) {
+        addCost(Variable ? 2 : 1);
+        break;
+      }
+      // Scalarized lanes are registers of their own. A variable index goes
+      // through a copy of the vector on the stack.
+      uint64_t Lanes = VectorShape::unpack(R.Aux).Lanes;
+      if (Access == LaneAccess::ExtractVariable)
+        addCost(ISA.LoadStoreCost * (Lanes + 1));
+      else if (Access == LaneAccess::InsertVariable)
+        addCost(ISA.LoadStoreCost * (2 * Lanes + 1));
+      break;
+    }
+    case InstKind::Add:
+      countAdd(Ops[0], Ops[1]);
+      break;
+    case InstKind::Mul:
+      countMul(Ops[0], Ops[1]);
+      break;
+    case InstKind::MulAdd:
+      countMulAdd(Ops[0], Ops[1], Ops[2]);
+      break;
+    case InstKind::Shr: {
+      auto &Info = getInfo(Ops[0]);
+      if (Info.Pattern == ValuePattern::Sub &&
+          fitsUInt(Ops[1], ImmField::ShAmt)) {
+        request(Info.Op0);
+        request(Info.Op1);
+        addCost();
+        break;
+      }
+    }
+      [[fallthrough]];
+    case InstKind::Shl:
+      if (!fitsInt(Ops[0], ImmField::ShiftImm))
+        request(Ops[0]);
+      else if (!fitsUInt(Ops[1], ImmField::ShAmt))
+        request(Ops[1]);
+      addCost();
+      break;
+    case InstKind::UDiv:
+      countDiv(Ops[0], Ops[1], /*Signed=*/false);
+      break;
+    case InstKind::SDiv:
+      countDiv(Ops[0], Ops[1], /*Signed=*/true);
+      break;
+    }
+  }
+
+public:
+  CostEvaluator(const FunctionFeatures &Features, const CostModel &Model,
+                std::set<std::string> *UnsupportedIntrinsics,
+                CostBreakdown *Breakdown)
+      : Features{Features}, ISA{Model.ISA}, Imm{Model.Imm}, Remat{Model.Remat},
+        HoistedConstants{Model.HoistedConstants},
+        UnsupportedIntrinsics{UnsupportedIntrinsics}, Breakdown{Breakdown},
+        RequestedValues(Features.Values.size()) {
+    if constexpr (UseTable) {
+      Shapes.resize(Features.Values.size());
+      for (uint32_t Id = 0; Id < Shapes.size(); ++Id)
+        Shapes[Id] = classify(Id);
+    }
+  }
+
+  uint64_t run(double *Dynamic, std::vector<uint32_t> *Pooled) {
+    if (!Features.Blocks.empty())
+      CurBlock = Features.Blocks.size() - 1;
+    for (auto Id : Features.PhiUses)
+      request(Id);
+
+    bool Visit = false;
+    auto NextBlock = Features.Blocks.begin();
+    for (uint32_t Idx = 0; Idx < Features.Insts.size(); ++Idx) {
+      auto &R = Features.Insts[Idx];
+      for (; NextBlock != Features.Blocks.end() && NextBlock->FirstInst <= Idx;
+           ++NextBlock) {
+        CurFreq = NextBlock->Freq;
+        CurBlock = NextBlock - Features.Blocks.begin();
+      }
+      if (!(R.Flags & InstRecord::Continuation))
+        Visit =
+            !(R.Flags & InstRecord::Dead) || RequestedValues.test(R.Id);
+      if (Visit) {
+        CurClass = R.Opcode;
+        apply(R);
+      }
+    }
+
+    auto &Blocks = Features.Blocks;
+    SmallVector<HoistCandidate, 16> Candidates;
+    CurFreq = 1.0;
+    for (auto Id : RequestedConstants) {
+      auto &Info = getInfo(Id);
+      CurClass = (Info.Flags & ValueInfo::IsScalarInt) ? ConstIntClass
+                                                        : ConstFPClass;
+      bool IsPooled;
+      uint64_t Unit = getMaterializationCost(Info, IsPooled);
+      if (IsPooled && Pooled)
+        Pooled->push_back(Id);
+      auto It = ConstantUses.find(Id);
+      if (It == ConstantUses.end()) {
+        addCost(Unit);
+        continue;
+      }
+      auto &Uses = It->second;
+      llvm::sort(Uses);
+      Uses.erase(std::unique(Uses.begin(), Uses.end()), Uses.end());
+      uint32_t Home = getHoistBlock(Uses);
+      double UseFreq = 0.0;
+      for (auto Use : Uses)
+        UseFreq += Blocks[Use].Freq;
+      Candidates.push_back(
+          {Id, Unit, Home, &Uses, (UseFreq - Blocks[Home].Freq) * Unit});
+    }
+
+    // Registers go to the constants that save the most.
+    llvm::stable_sort(Candidates, [](auto &LHS, auto &RHS) {
+      return LHS.Savings > RHS.Savings;
+    });
+    for (uint32_t Idx = 0; Idx < Candidates.size(); ++Idx) {
+      auto &C = Candidates[Idx];
+      CurClass = (getInfo(C.Id).Flags & ValueInfo::IsScalarInt) ? ConstIntClass
+                                                                : ConstFPClass;
+      if (Idx < HoistedConstants && C.Savings > 0.0) {
+        CurFreq = Blocks[C.Home].Freq;
+        addCost(C.Unit);
+        continue;
+      }
+      for (auto Use : *C.Uses) {
+        CurFreq = Blocks[Use].Freq;
+        addCost(C.Unit);
+      }
+    }
+    if (Dynamic)
+      *Dynamic = DynamicCost;
+    return Cost;
+  }
+};
+} // namespace
+
+FeatureAnalyses::TargetAnalyses::TargetAnalyses(const Triple &T) : TLII(T) {
+  FAM.registerPass([] { return PassInstrumentationAnalysis(); });
+  FAM.registerPass([] { return AssumptionAnalysis(); });
+  FAM.registerPass([] { return DominatorTreeAnalysis(); });
+  FAM.registerPass([] { return PostDominatorTreeAnalysis(); });
+  FAM.registerPass([] { return LoopAnalysis(); });
+  FAM.registerPass([] { return BranchProbabilityAnalysis(); });
+  FAM.registerPass([] { return BlockFrequencyAnalysis(); });
+  FAM.registerPass([this] { return TargetLibraryAnalysis(TLII); });
+}
+
+FeatureAnalyses::TargetAnalyses &FeatureAnalyses::get(Function &F) {
+  auto &TargetTriple = F.getParent()->getTargetTriple();
+  auto &Target = Targets[TargetTriple];
+  if (!Target)
+    Target = std::make_unique<TargetAnalyses>(Triple(TargetTriple));
+  return *Target;
+}
+
+FunctionFeatures extractFeatures(Function &F, FeatureAnalyses &FA) {
+  FunctionFeatures Features;
+  Features.Name = F.getName().str();
+  auto &Target = FA.get(F);
+  auto &FAM = Target.FAM;
+  // Not the function-specific TLI from FAM: honoring no-builtin attributes
+  // would change costs.
+  TargetLibraryInfo TLI{Target.TLII};
+  FeatureExtractor Extractor{*F.getParent(), F, Features, FA};
+  Extractor.run(F, FAM.getResult<AssumptionAnalysis>(F),
+                FAM.getResult<DominatorTreeAnalysis>(F), TLI,
+                FA.BlockFrequencies
+                    ? &FAM.getResult<BlockFrequencyAnalysis>(F)
+                    : nullptr);
+  FAM.clear(F, F.getName());
+  return Features;
+}
+
+const char *getCostClassName(uint32_t Class) {
+  if (Class == ConstIntClass)
+    return "const.int";
+  if (Class == ConstFPClass)
+    return "const.fp";
+  return Instruction::getOpcodeName(Class);
+}
+
+uint64_t evaluateCost(const FunctionFeatures &F, const CostModel &Model,
+                      std::set<std::string> *UnsupportedIntrinsics,
+                      CostBreakdown *Breakdown, double *DynamicCost,
+                      std::vector<uint32_t> *PooledConstants) {
+  return CostEvaluator<true>{F, Model, UnsupportedIntrinsics, Breakdown}.run(
+      DynamicCost, PooledConstants);
+}
+
+uint64_t evaluateCostReference(const FunctionFeatures &F,
+                               const CostModel &Model,
+                               std::set<std::string> *UnsupportedIntrinsics,
+                               CostBreakdown *Breakdown, double *DynamicCost,
+                               std::vector<uint32_t> *PooledConstants) {
+  return CostEvaluator<false>{F, Model, UnsupportedIntrinsics, Breakdown}.run(
+      DynamicCost, PooledConstants);
+}
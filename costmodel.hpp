@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/TargetParser/Triple.h>
+#include "isa.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The estimator works in two stages. Feature extraction walks the IR once
+// and records everything that does not depend on the ISA: which values an
+// instruction reads, which patterns its operands match and the constants
+// involved. Evaluation then replays these records against an ISA, so that
+// many ISAs can be scored without touching the IR again.
+
+// An ISA configuration together with its precomputed immediate ranges.
+struct CostModel {
+  ISAConfig ISA;
+  ISARanges Imm;
+
+  // If set, a constant is materialized in every block that uses it, except
+  // for up to HoistedConstants of them per function that are kept in
+  // registers. Those are placed in the coldest block that dominates all of
+  // their uses; the ones that save the most dynamic cost win.
+  bool Remat = false;
+  uint32_t HoistedConstants = 0;
+
+  explicit CostModel(const ISAConfig &ISA) : ISA{ISA}, Imm{ISA} {}
+};
+
+// Immediate fields an operand can be folded into.
+enum class ImmField : uint8_t {
+  ShAmt,
+  AddSub,
+  ShiftImm,
+  MulDiv,
+  SmallMul,
+  Cmp,
+  MinMax,
+  Select,
+  BranchCmp,
+};
+constexpr uint32_t NumImmFields =
+    static_cast<uint32_t>(ImmField::BranchCmp) + 1;
+
+// Prices taken from the ISA.
+enum class CostKind : uint8_t {
+  None,
+  One,
+  LoadStore,
+  Jump,
+  Mul,
+  Div,
+  FDiv,
+  FMul,
+  FCheapOp,
+  Call, // GlobalCost + JumpCost
+  BitCount,
+  Unsupported,
+};
+
+// Instruction patterns an operand is checked against.
+enum class ValuePattern : uint8_t { None, Shl, Mul, Sub };
+
+// Accesses of a single vector lane.
+enum class LaneAccess : uint8_t {
+  Extract,
+  Insert,
+  // The lane index is not a constant.
+  ExtractVariable,
+  InsertVariable,
+};
+
+// The vector a vector record works on, packed into the record's Aux.
+struct VectorShape {
+  static constexpr uint32_t MaxLanes = (1U << 24) - 1;
+  static constexpr uint32_t MaxLaneBits = 255;
+
+  uint32_t Lanes;
+  uint32_t LaneBits;
+
+  uint32_t pack() const { return Lanes << 8 | LaneBits; }
+  static VectorShape unpack(uint32_t Aux) { return {Aux >> 8, Aux & 255}; }
+};
+
+// ISA-independent facts about a value.
+struct ValueInfo {
+  enum : uint8_t {
+    IsZero = 1 << 0,
+    // Every lane is an integer narrower than 64 bits; SMin/SMax/UMax bound
+    // them.
+    IsSmallInt = 1 << 1,
+    IsPower2 = 1 << 2,
+    // A ConstantInt of at most 64 bits; SMin holds its sign-extended value.
+    IsScalarInt = 1 << 3,
+    IsBitImm = 1 << 4,
+    // A ConstantFP; SMin holds the low 64 bits of its bit pattern.
+    IsScalarFP = 1 << 5,
+    // A ConstantFP that converts to half exactly.
+    IsHalfFP = 1 << 6,
+  };
+  uint8_t Flags = 0;
+  ValuePattern Pattern = ValuePattern::None;
+  // Size of IsScalarInt and IsScalarFP constants, e.g. in a constant pool.
+  uint8_t Bytes = 0;
+  // Operands of Pattern.
+  uint32_t Op0 = 0;
+  uint32_t Op1 = 0;
+  int64_t SMin = 0;
+  int64_t SMax = 0;
+  uint64_t UMax = 0;
+};
+
+enum class InstKind : uint8_t {
+  // Requests every operand and adds Aux times the cost of CostKind(Arg).
+  Request,
+  // Requests operand 0 unless it fits the immediate field ImmField(Arg).
+  RequestUnlessImm,
+  // Adds UnsupportedCost and reports intrinsic Aux.
+  UnsupportedIntrinsic,
+  // Requests every operand and adds the cost of CostKind(Arg) for every lane
+  // of VectorShape(Aux), or for every register the vector takes up if the
+  // ISA has vector registers.
+  VectorOp,
+  // Requests every operand and adds the cost of folding the lanes of
+  // VectorShape(Aux) into one with CostKind(Arg).
+  VectorReduce,
+  // Requests every operand and performs LaneAccess(Arg) on VectorShape(Aux).
+  VectorLane,
+  // Operand-dependent rules, see CostEvaluator.
+  Add,
+  Mul,
+  MulAdd,
+  Shr,
+  Shl,
+  UDiv,
+  SDiv,
+};
+
+// One step of the cost rule of an instruction. Steps after the first one of
+// an instruction are marked as continuations.
+struct InstRecord {
+  enum : uint8_t {
+    // The instruction is only costed if a user requests it.
+    Dead = 1 << 0,
+    Continuation = 1 << 1,
+    // RequestUnlessImm checks a signed immediate.
+    Signed = 1 << 2,
+  };
+  uint32_t Id;
+  InstKind Kind;
+  uint8_t Flags;
+  uint8_t Arg;
+  // LLVM opcode of the instruction, used to attribute its cost.
+  uint8_t Opcode;
+  uint32_t Aux;
+  uint32_t FirstOp;
+  uint32_t NumOps;
+};
+
+// Records from FirstInst up to the next block belong to a basic block that
+// runs Freq times per call of the function. Blocks are numbered in post-order,
+// so the dominators of a block have larger numbers and the entry block, which
+// is its own immediate dominator, comes last.
+struct BlockRecord {
+  uint32_t FirstInst;
+  double Freq;
+  uint32_t IDom;
+};
+
+// Features of one function. Value ids index Values; id 0 stands for every
+// value that can neither be costed nor folded (arguments, globals, ...).
+struct FunctionFeatures {
+  std::string Name;
+  std::vector<ValueInfo> Values;
+  // Incoming values of reachable PHI nodes.
+  std::vector<uint32_t> PhiUses;
+  // Records in visiting order: blocks in post-order, instructions bottom-up.
+  std::vector<InstRecord> Insts;
+  // Blocks in the order of their records.
+  std::vector<BlockRecord> Blocks;
+  std::vector<uint32_t> Operands;
+  std::vector<std::string> Intrinsics;
+};
+
+// Analyses used by feature extraction. They live in a FunctionAnalysisManager
+// so that a worker sets the managers up once instead of once per function.
+// Library info only depends on the target triple and is costly to build, so
+// there is one manager per triple, seeded with that triple's library info.
+class FeatureAnalyses final {
+public:
+  struct TargetAnalyses {
+    llvm::TargetLibraryInfoImpl TLII;
+    llvm::FunctionAnalysisManager FAM;
+
+    explicit TargetAnalyses(const llvm::Triple &T);
+  };
+
+  TargetAnalyses &get(llvm::Function &F);
+
+  // Descriptions of scalar ConstantInt and ConstantFP values. They are keyed
+  // by type and bit pattern rather than by pointer, so that entries stay
+  // valid when the LLVMContext that interned a constant is recycled.
+  llvm::DenseMap<std::pair<uint64_t, uint64_t>, ValueInfo> Constants;
+  uint64_t ConstantLookups = 0;
+  uint64_t ConstantHits = 0;
+
+  // Whether block frequencies are estimated. Otherwise every block runs once
+  // per call, which saves the loop, branch probability and block frequency
+  // analyses for tools that only need static costs.
+  bool BlockFrequencies = false;
+
+private:
+  llvm::StringMap<std::unique_ptr<TargetAnalyses>> Targets;
+};
+
+// Extracts the features of F. The analyses of F are dropped afterwards, as
+// they are keyed by a function that dies with its module.
+FunctionFeatures extractFeatures(llvm::Function &F, FeatureAnalyses &FA);
+
+// Cost classes of a breakdown: the LLVM opcode an instruction's cost is
+// charged to, followed by the materialization of requested constants.
+constexpr uint32_t ConstIntClass = llvm::Instruction::OtherOpsEnd;
+constexpr uint32_t ConstFPClass = ConstIntClass + 1;
+constexpr uint32_t NumCostClasses = ConstFPClass + 1;
+using CostBreakdown = std::array<uint64_t, NumCostClasses>;
+
+const char *getCostClassName(uint32_t Class);
+
+// Static cost of F under Model. Unsupported intrinsics that are costed are
+// added to UnsupportedIntrinsics, the cost is split by class into Breakdown,
+// the cost of one call weighted by block frequency is stored in DynamicCost,
+// and the ids of constants that are loaded from a constant pool are appended
+// to PooledConstants, if they are not null. Constants are assumed to be
+// materialized once per call unless Model.Remat is set.
+uint64_t evaluateCost(const FunctionFeatures &F, const CostModel &Model,
+                      std::set<std::string> *UnsupportedIntrinsics = nullptr,
+                      CostBreakdown *Breakdown = nullptr,
+                      double *DynamicCost = nullptr,
+                      std::vector<uint32_t> *PooledConstants = nullptr);
+
+// Same as evaluateCost, but every immediate check is computed when a rule
+// asks for it instead of being looked up in the per-value shape table.
+uint64_t
+evaluateCostReference(const FunctionFeatures &F, const CostModel &Model,
+                      std::set<std::string> *UnsupportedIntrinsics = nullptr,
+                      CostBreakdown *Breakdown = nullptr,
+                      double *DynamicCost = nullptr,
+                      std::vector<uint32_t> *PooledConstants = nullptr);
@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/bit.h>
+#include "columnfile.hpp"
+#include "costmodel.hpp"
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Extracted features of one module, as stored in a feature dump.
+struct FeatureModule {
+  std::string Name;
+  std::vector<FunctionFeatures> Functions;
+};
+
+// A feature dump stores every field in its own column (see ColumnWriter): the
+// column holds that field for all modules, functions, values or records of
+// the corpus back to back, so replaying a dump runs at memory speed instead
+// of IR parsing speed. The header count is the number of modules.
+enum FeatureColumn : uint32_t {
+  ModuleNames,
+  ModuleSizes,      // functions per module
+  FunctionNames,
+  FunctionSizes,    // values, PHI uses, records, blocks, operands, intrinsics
+  ValueFlags,       // ValueInfo::Flags
+  ValuePatterns,    // ValueInfo::Pattern
+  PatternOperands,  // Op0, Op1 of values with a pattern
+  ConstantBounds,   // SMin, SMax, UMax of IsSmallInt/IsScalar* values
+  ConstantSizes,    // ValueInfo::Bytes of IsScalarInt/IsScalarFP values
+  PhiUses,
+  RecordIds,
+  RecordKinds,
+  RecordFlags,
+  RecordArgs,
+  RecordOpcodes,
+  RecordAux,
+  RecordNumOperands,
+  RecordOperands,
+  BlockStarts,      // BlockRecord::FirstInst
+  BlockFreqs,       // BlockRecord::Freq as the bits of a double
+  BlockIDoms,       // BlockRecord::IDom
+  IntrinsicNames,
+  NumFeatureColumns
+};
+
+// Bump this whenever the extracted features change meaning.
+constexpr uint32_t FeatureDumpVersion = 8;
+constexpr uint32_t FeatureDumpMagic = 0x44463652; // "R6FD"
+
+class FeatureDumpWriter final {
+  ColumnWriter<NumFeatureColumns> Columns;
+  uint32_t NumModules = 0;
+
+  template <typename T> void put(FeatureColumn Column, T Value) {
+    Columns.put<T>(Column, Value);
+  }
+  template <typename T>
+  void putAll(FeatureColumn Column, llvm::ArrayRef<T> Values) {
+    for (auto Value : Values)
+      put<T>(Column, Value);
+  }
+  void putName(FeatureColumn Column, llvm::StringRef Name) {
+    Columns.putName(Column, Name);
+  }
+
+public:
+  void addModule(const FeatureModule &M) {
+    ++NumModules;
+    putName(ModuleNames, M.Name);
+    put<uint32_t>(ModuleSizes, M.Functions.size());
+    for (auto &F : M.Functions) {
+      putName(FunctionNames, F.Name);
+      put<uint32_t>(FunctionSizes, F.Values.size());
+      put<uint32_t>(FunctionSizes, F.PhiUses.size());
+      put<uint32_t>(FunctionSizes, F.Insts.size());
+      put<uint32_t>(FunctionSizes, F.Blocks.size());
+      put<uint32_t>(FunctionSizes, F.Operands.size());
+      put<uint32_t>(FunctionSizes, F.Intrinsics.size());
+      for (auto &Info : F.Values) {
+        put<uint8_t>(ValueFlags, Info.Flags);
+        put<uint8_t>(ValuePatterns, static_cast<uint8_t>(Info.Pattern));
+        if (Info.Pattern != ValuePattern::None) {
+          put<uint32_t>(PatternOperands, Info.Op0);
+          put<uint32_t>(PatternOperands, Info.Op1);
+        }
+        if (Info.Flags & (ValueInfo::IsSmallInt | ValueInfo::IsScalarInt |
+                          ValueInfo::IsScalarFP)) {
+          put<int64_t>(ConstantBounds, Info.SMin);
+          put<int64_t>(ConstantBounds, Info.SMax);
+          put<uint64_t>(ConstantBounds, Info.UMax);
+        }
+        if (Info.Flags & (ValueInfo::IsScalarInt | ValueInfo::IsScalarFP))
+          put<uint8_t>(ConstantSizes, Info.Bytes);
+      }
+      putAll<uint32_t>(PhiUses, F.PhiUses);
+      for (auto &R : F.Insts) {
+        put<uint32_t>(RecordIds, R.Id);
+        put<uint8_t>(RecordKinds, static_cast<uint8_t>(R.Kind));
+        put<uint8_t>(RecordFlags, R.Flags);
+        put<uint8_t>(RecordArgs, R.Arg);
+        put<uint8_t>(RecordOpcodes, R.Opcode);
+        put<uint32_t>(RecordAux, R.Aux);
+        put<uint32_t>(RecordNumOperands, R.NumOps);
+      }
+      putAll<uint32_t>(RecordOperands, F.Operands);
+      for (auto &Block : F.Blocks) {
+        put<uint32_t>(BlockStarts, Block.FirstInst);
+        put<uint64_t>(BlockFreqs, llvm::bit_cast<uint64_t>(Block.Freq));
+        put<uint32_t>(BlockIDoms, Block.IDom);
+      }
+      for (auto &Name : F.Intrinsics)
+        putName(IntrinsicNames, Name);
+    }
+  }
+
+  bool write(const std::string &Path, std::string &Err) const {
+    return Columns.write(Path, FeatureDumpMagic, FeatureDumpVersion,
+                         NumModules, Err);
+  }
+};
+
+class FeatureDumpReader final {
+  ColumnReader<NumFeatureColumns> Columns;
+
+  template <typename T> T get(FeatureColumn Column) {
+    return Columns.get<T>(Column);
+  }
+  template <typename T>
+  void getAll(FeatureColumn Column, std::vector<T> &Values, uint32_t Size) {
+    Values.resize(Size);
+    for (auto &Value : Values)
+      Value = get<T>(Column);
+  }
+  std::string getName(FeatureColumn Column) { return Columns.getName(Column); }
+  // Whether Column still holds Count entries of at least Size bytes, so that
+  // a corrupt count is rejected before anything is allocated for it.
+  bool fits(FeatureColumn Column, uint64_t Count, size_t Size) const {
+    return Count <= Columns.getRemaining(Column) / Size;
+  }
+  // Ids and enum values index tables in the evaluator, so they are checked
+  // once here rather than on every replay.
+  static bool isValid(const FunctionFeatures &F) {
+    auto IsId = [&](uint32_t Id) { return Id < F.Values.size(); };
+    for (auto &Info : F.Values)
+      if (Info.Pattern > ValuePattern::Sub || !IsId(Info.Op0) ||
+          !IsId(Info.Op1))
+        return false;
+    if (!llvm::all_of(F.PhiUses, IsId) || !llvm::all_of(F.Operands, IsId))
+      return false;
+    for (auto &R : F.Insts) {
+      if (!IsId(R.Id) || R.Kind > InstKind::SDiv || R.Opcode >= ConstIntClass)
+        return false;
+      if (R.Kind == InstKind::Request &&
+          R.Arg > uint8_t(CostKind::Unsupported))
+        return false;
+      if (R.Kind == InstKind::RequestUnlessImm &&
+          (R.NumOps != 1 || R.Arg > uint8_t(ImmField::BranchCmp)))
+        return false;
+      if (R.Kind == InstKind::UnsupportedIntrinsic &&
+          R.Aux >= F.Intrinsics.size())
+        return false;
+      if (R.Kind >= InstKind::VectorOp && R.Kind <= InstKind::VectorLane) {
+        auto Shape = VectorShape::unpack(R.Aux);
+        if (Shape.LaneBits == 0 ||
+            (R.Kind == InstKind::VectorReduce && Shape.Lanes == 0))
+          return false;
+        if (R.Arg > (R.Kind == InstKind::VectorLane
+                         ? uint8_t(LaneAccess::InsertVariable)
+                         : uint8_t(CostKind::Unsupported)))
+          return false;
+      }
+      if (R.Kind >= InstKind::Add &&
+          R.NumOps != (R.Kind == InstKind::MulAdd ? 3U : 2U))
+        return false;
+    }
+    // Dominators must come later in post-order, so that walking up the
+    // dominator tree ends at the entry block.
+    uint32_t FirstInst = 0;
+    for (uint32_t Idx = 0; Idx < F.Blocks.size(); ++Idx) {
+      auto &Block = F.Blocks[Idx];
+      bool IsEntry = Idx + 1 == F.Blocks.size();
+      if (Block.FirstInst < FirstInst || Block.FirstInst > F.Insts.size() ||
+          !std::isfinite(Block.Freq) || Block.Freq < 0.0)
+        return false;
+      if (IsEntry ? Block.IDom != Idx
+                  : Block.IDom <= Idx || Block.IDom >= F.Blocks.size())
+        return false;
+      FirstInst = Block.FirstInst;
+    }
+    return true;
+  }
+
+public:
+  bool open(const std::string &Path, std::string &Err) {
+    if (!Columns.open(Path, FeatureDumpMagic, FeatureDumpVersion, Err))
+      return false;
+    if (!fits(ModuleSizes, getNumModules(), sizeof(uint32_t)) ||
+        !fits(ModuleNames, getNumModules(), 1)) {
+      Err = Path + ": malformed feature dump";
+      return false;
+    }
+    return true;
+  }
+
+  uint32_t getNumModules() const { return Columns.getCount(); }
+
+  // Reads the next module. Returns false if the dump is malformed.
+  bool next(FeatureModule &M) {
+    M.Name = getName(ModuleNames);
+    uint32_t NumFunctions = get<uint32_t>(ModuleSizes);
+    if (!fits(FunctionSizes, NumFunctions, 6 * sizeof(uint32_t)) ||
+        !fits(FunctionNames, NumFunctions, 1))
+      return false;
+    M.Functions.resize(NumFunctions);
+    for (auto &F : M.Functions) {
+      F.Name = getName(FunctionNames);
+      uint32_t NumValues = get<uint32_t>(FunctionSizes);
+      uint32_t NumPhiUses = get<uint32_t>(FunctionSizes);
+      uint32_t NumInsts = get<uint32_t>(FunctionSizes);
+      uint32_t NumBlocks = get<uint32_t>(FunctionSizes);
+      uint32_t NumOperands = get<uint32_t>(FunctionSizes);
+      uint32_t NumIntrinsics = get<uint32_t>(FunctionSizes);
+      if (Columns.isTruncated() || !fits(ValueFlags, NumValues, 1) ||
+          !fits(PhiUses, NumPhiUses, sizeof(uint32_t)) ||
+          !fits(RecordIds, NumInsts, sizeof(uint32_t)) ||
+          !fits(BlockStarts, NumBlocks, sizeof(uint32_t)) ||
+          !fits(RecordOperands, NumOperands, sizeof(uint32_t)) ||
+          !fits(IntrinsicNames, NumIntrinsics, 1))
+        return false;
+
+      F.Values.resize(NumValues);
+      for (auto &Info : F.Values) {
+        Info.Flags = get<uint8_t>(ValueFlags);
+        Info.Pattern = static_cast<ValuePattern>(get<uint8_t>(ValuePatterns));
+        if (Info.Pattern != ValuePattern::None) {
+          Info.Op0 = get<uint32_t>(PatternOperands);
+          Info.Op1 = get<uint32_t>(PatternOperands);
+        }
+        if (Info.Flags & (ValueInfo::IsSmallInt | ValueInfo::IsScalarInt |
+                          ValueInfo::IsScalarFP)) {
+          Info.SMin = get<int64_t>(ConstantBounds);
+          Info.SMax = get<int64_t>(ConstantBounds);
+          Info.UMax = get<uint64_t>(ConstantBounds);
+        }
+        if (Info.Flags & (ValueInfo::IsScalarInt | ValueInfo::IsScalarFP))
+          Info.Bytes = get<uint8_t>(ConstantSizes);
+      }
+      getAll<uint32_t>(PhiUses, F.PhiUses, NumPhiUses);
+      F.Insts.resize(NumInsts);
+      uint64_t FirstOp = 0;
+      for (auto &R : F.Insts) {
+        R.Id = get<uint32_t>(RecordIds);
+        R.Kind = static_cast<InstKind>(get<uint8_t>(RecordKinds));
+        R.Flags = get<uint8_t>(RecordFlags);
+        R.Arg = get<uint8_t>(RecordArgs);
+        R.Opcode = get<uint8_t>(RecordOpcodes);
+        R.Aux = get<uint32_t>(RecordAux);
+        R.NumOps = get<uint32_t>(RecordNumOperands);
+        R.FirstOp = FirstOp;
+        FirstOp += R.NumOps;
+      }
+      getAll<uint32_t>(RecordOperands, F.Operands, NumOperands);
+      F.Blocks.resize(NumBlocks);
+      for (auto &Block : F.Blocks) {
+        Block.FirstInst = get<uint32_t>(BlockStarts);
+        Block.Freq = llvm::bit_cast<double>(get<uint64_t>(BlockFreqs));
+        Block.IDom = get<uint32_t>(BlockIDoms);
+      }
+      F.Intrinsics.resize(NumIntrinsics);
+      for (auto &Name : F.Intrinsics)
+        Name = getName(IntrinsicNames);
+      if (Columns.isTruncated() || FirstOp != NumOperands || !isValid(F))
+        return false;
+    }
+    return !Columns.isTruncated();
+  }
+};
+
+inline bool loadFeatureDump(const std::string &Path,
+                            std::vector<FeatureModule> &Modules,
+                            std::string &Err) {
+  FeatureDumpReader Reader;
+  if (!Reader.open(Path, Err))
+    return false;
+  Modules.resize(Reader.getNumModules());
+  for (auto &M : Modules) {
+    if (!Reader.next(M)) {
+      Err = Path + ": malformed feature dump";
+      return false;
+    }
+  }
+  return true;
+}
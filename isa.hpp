@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+#include "immbits.hpp"
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+
+// Immediate field widths. Defaults come from immbits.hpp.
+#define R6_IMM_FIELDS(X)                                                       \
+  X(ShAmtBits)                                                                 \
+  X(AddSubImmBits)                                                             \
+  X(BitImmBits)                                                                \
+  X(SelectImmBits)                                                             \
+  X(SmallSelectImmBits)                                                        \
+  X(LargeImmBits)                                                              \
+  X(ShiftImmBits)                                                              \
+  X(MinMaxImmBits)                                                             \
+  X(MulDivBits)                                                                \
+  X(SmallMulBits)                                                              \
+  X(FPImmBits)                                                                 \
+  X(FPSmallImmBits)                                                            \
+  X(NotBit)                                                                    \
+  X(NegBit)                                                                    \
+  X(LinkBit)                                                                   \
+  X(CmpImmBits)                                                                \
+  X(JumpOffsetImmBits)                                                         \
+  X(BranchOffsetImmBits)                                                       \
+  X(BranchCmpImmBits)
+
+// Instruction format parameters used by encode, with their defaults.
+#define R6_ENCODING_FIELDS(X)                                                  \
+  X(InstructionBits, 32)                                                       \
+  X(RegBits, 5)                                                                \
+  X(OpTypeBits, 2)
+
+// Costs used by the estimator, with their defaults. VectorBits is the
+// register width of a hypothetical vector extension; without one (0), vector
+// code is scalarized.
+#define R6_COST_FIELDS(X)                                                      \
+  X(LoadStoreCost, 4)                                                          \
+  X(JumpCost, 1)                                                               \
+  X(MulCost, 3)                                                                \
+  X(DivCost, 12)                                                               \
+  X(FDivCost, 30)                                                              \
+  X(FMulCost, 5)                                                               \
+  X(FCheapOpCost, 3)                                                           \
+  X(GlobalCost, 2)                                                             \
+  X(BitCountCost, 3)                                                           \
+  X(UnsupportedCost, 0)                                                        \
+  X(VectorBits, 0)
+
+// Inclusive value ranges of a Bits-wide immediate, so that range checks on
+// the estimator's hot path are two comparisons.
+struct ImmRange {
+  int64_t SMin = 0;
+  int64_t SMax = -1;
+  uint64_t UMax = 0;
+
+  constexpr ImmRange() = default;
+  constexpr explicit ImmRange(uint32_t Bits) {
+    if (Bits == 0)
+      return;
+    if (Bits >= 64) {
+      SMin = std::numeric_limits<int64_t>::min();
+      SMax = std::numeric_limits<int64_t>::max();
+      UMax = std::numeric_limits<uint64_t>::max();
+      return;
+    }
+    SMin = -(int64_t{1} << (Bits - 1));
+    SMax = (int64_t{1} << (Bits - 1)) - 1;
+    UMax = (uint64_t{1} << Bits) - 1;
+  }
+
+  constexpr bool fitsSigned(int64_t V) const { return V >= SMin && V <= SMax; }
+  constexpr bool fitsUnsigned(uint64_t V) const { return V <= UMax; }
+};
+
+// A complete ISA description. It can be loaded from a text file with one
+// "Name = Value" assignment per line; '#' starts a comment and fields that
+// are not mentioned keep their defaults.
+struct ISAConfig {
+#define R6_DECLARE_IMM(Name) uint32_t Name = ::Name;
+  R6_IMM_FIELDS(R6_DECLARE_IMM)
+#undef R6_DECLARE_IMM
+#define R6_DECLARE_ENCODING(Name, Default) uint32_t Name = Default;
+  R6_ENCODING_FIELDS(R6_DECLARE_ENCODING)
+#undef R6_DECLARE_ENCODING
+#define R6_DECLARE_COST(Name, Default) uint64_t Name = Default;
+  R6_COST_FIELDS(R6_DECLARE_COST)
+#undef R6_DECLARE_COST
+
+  // Calls Callback(Name, Value) for every field in declaration order.
+  template <typename Fn> void forEachField(Fn &&Callback) const {
+#define R6_VISIT_IMM(Name) Callback(std::string_view{#Name}, uint64_t{Name});
+    R6_IMM_FIELDS(R6_VISIT_IMM)
+#undef R6_VISIT_IMM
+#define R6_VISIT_ENCODING(Name, Default)                                       \
+  Callback(std::string_view{#Name}, uint64_t{Name});
+    R6_ENCODING_FIELDS(R6_VISIT_ENCODING)
+#undef R6_VISIT_ENCODING
+#define R6_VISIT_COST(Name, Default) Callback(std::string_view{#Name}, Name);
+    R6_COST_FIELDS(R6_VISIT_COST)
+#undef R6_VISIT_COST
+  }
+
+  // Returns false if there is no field called Name or Value is out of its
+  // range: immediates are at most 64 bits wide, as ImmRange cannot describe
+  // wider ones, and encoding fields are 32-bit.
+  bool set(std::string_view Name, uint64_t Value) {
+#define R6_SET_NARROW(Field, Max)                                              \
+  if (Name == #Field) {                                                        \
+    if (Value > (Max))                                                         \
+      return false;                                                            \
+    Field = static_cast<uint32_t>(Value);                                      \
+    return true;                                                               \
+  }
+#define R6_SET_IMM(Field) R6_SET_NARROW(Field, 64)
+#define R6_SET_ENCODING(Field, Default)                                        \
+  R6_SET_NARROW(Field, std::numeric_limits<uint32_t>::max())
+    R6_IMM_FIELDS(R6_SET_IMM)
+    R6_ENCODING_FIELDS(R6_SET_ENCODING)
+#undef R6_SET_ENCODING
+#undef R6_SET_IMM
+#undef R6_SET_NARROW
+#define R6_SET_COST(Field, Default)                                            \
+  if (Name == #Field) {                                                        \
+    Field = Value;                                                             \
+    return true;                                                               \
+  }
+    R6_COST_FIELDS(R6_SET_COST)
+#undef R6_SET_COST
+    return false;
+  }
+
+  // Returns true if there is a field called Name.
+  bool hasField(std::string_view Name) const {
+    bool Found = false;
+    forEachField([&](std::string_view Field, uint64_t) {
+      Found = Found || Field == Name;
+    });
+    return Found;
+  }
+
+  // Describes why set(Name, Value) failed.
+  static std::string getSetError(std::string_view Name) {
+    if (!ISAConfig{}.hasField(Name))
+      return "unknown field '" + std::string(Name) + "'";
+    return "value out of range for " + std::string(Name);
+  }
+
+  // Applies a single "Name=Value" assignment. Blanks around the name and
+  // the value are ignored.
+  bool assign(std::string_view Item, std::string &Err) {
+    auto Eq = Item.find('=');
+    if (Eq == std::string_view::npos) {
+      Err = "expected Name=Value, got '" + std::string(Item) + "'";
+      return false;
+    }
+    auto Name = trim(Item.substr(0, Eq));
+    auto Str = trim(Item.substr(Eq + 1));
+    uint64_t Value;
+    auto [Ptr, EC] =
+        std::from_chars(Str.data(), Str.data() + Str.size(), Value);
+    if (EC != std::errc{} || Ptr != Str.data() + Str.size()) {
+      Err = "invalid value for " + std::string(Name) + ": '" +
+            std::string(Str) + "'";
+      return false;
+    }
+    if (!set(Name, Value)) {
+      Err = getSetError(Name);
+      return false;
+    }
+    return true;
+  }
+
+  // Applies a comma-separated list of Name=Value overrides, e.g.
+  // "AddSubImmBits=12,MulCost=4".
+  bool apply(std::string_view Spec, std::string &Err) {
+    while (!Spec.empty()) {
+      auto Comma = Spec.find(',');
+      auto Item = Spec.substr(0, Comma);
+      Spec = Comma == std::string_view::npos ? std::string_view{}
+                                             : Spec.substr(Comma + 1);
+      if (!trim(Item).empty() && !assign(Item, Err))
+        return false;
+    }
+    return true;
+  }
+
+  bool load(const std::string &Path, std::string &Err) {
+    std::ifstream File(Path);
+    if (!File.is_open()) {
+      Err = "cannot open " + Path;
+      return false;
+    }
+    std::string Line;
+    for (uint32_t LineNo = 1; std::getline(File, Line); ++LineNo) {
+      std::string_view Item = Line;
+      Item = trim(Item.substr(0, Item.find('#')));
+      if (!Item.empty() && !assign(Item, Err)) {
+        Err = Path + ":" + std::to_string(LineNo) + ": " + Err;
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  static std::string_view trim(std::string_view Str) {
+    auto Begin = Str.find_first_not_of(" \t\r");
+    if (Begin == std::string_view::npos)
+      return {};
+    auto End = Str.find_last_not_of(" \t\r");
+    return Str.substr(Begin, End - Begin + 1);
+  }
+};
+
+// Precomputed ranges of the immediate fields used by the estimator.
+struct ISARanges {
+#define R6_DECLARE_RANGE(Name) ImmRange Name;
+  R6_IMM_FIELDS(R6_DECLARE_RANGE)
+#undef R6_DECLARE_RANGE
+  // LUI + ADDI pair.
+  ImmRange LargeAddSubImmBits;
+
+  explicit ISARanges(const ISAConfig &ISA)
+      : LargeAddSubImmBits(ISA.LargeImmBits + ISA.AddSubImmBits) {
+#define R6_INIT_RANGE(Name) Name = ImmRange(ISA.Name);
+    R6_IMM_FIELDS(R6_INIT_RANGE)
+#undef R6_INIT_RANGE
+  }
+};
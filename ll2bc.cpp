@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include "worker.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+using namespace llvm;
+namespace fs = std::filesystem;
+
+static cl::opt<std::string>
+    InputDir(cl::Positional, cl::desc("<directory for input LLVM IR files>"),
+             cl::Required, cl::value_desc("inputdir"));
+static cl::opt<std::string>
+    OutputDir(cl::Positional, cl::desc("<directory for output bitcode files>"),
+              cl::Required, cl::value_desc("outputdir"));
+static cl::opt<uint32_t> Jobs("j",
+                              cl::desc("Number of worker threads (0 = all "
+                                       "hardware threads)"),
+                              cl::init(1), cl::value_desc("N"));
+
+// Mirrors every .ll file under inputdir as .bc under outputdir, keeping the
+// relative layout so the scanners treat both trees the same way.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "bitcode mirror\n");
+
+  std::vector<fs::path> InputFiles;
+  for (auto &Entry : fs::recursive_directory_iterator(std::string(InputDir))) {
+    if (Entry.is_regular_file() && Entry.path().extension() == ".ll")
+      InputFiles.push_back(Entry.path());
+  }
+  errs() << "Input files: " << InputFiles.size() << '\n';
+  sortLargestFirst(InputFiles);
+
+  auto Base = fs::absolute(std::string(InputDir));
+  auto OutBase = fs::absolute(std::string(OutputDir));
+  WorkQueue Queue{InputFiles.size()};
+  ProgressCounter Progress;
+  std::atomic<uint32_t> Failed{0};
+  std::mutex DiagLock;
+
+  runWorkers(getNumWorkers(Jobs), [&](uint32_t) {
+    size_t Idx;
+    while (Queue.pop(Idx)) {
+      auto &Path = InputFiles[Idx];
+      LLVMContext Context;
+      SMDiagnostic Err;
+      auto M = parseIRFile(Path.string(), Err, Context);
+      if (!M) {
+        std::lock_guard Guard{DiagLock};
+        Err.print(argv[0], errs());
+        ++Failed;
+        continue;
+      }
+
+      auto OutPath = OutBase / fs::relative(Path, Base);
+      OutPath.replace_extension(".bc");
+      std::error_code EC;
+      fs::create_directories(OutPath.parent_path(), EC);
+      raw_fd_ostream OS(OutPath.string(), EC, sys::fs::OF_None);
+      if (EC) {
+        std::lock_guard Guard{DiagLock};
+        errs() << OutPath.string() << ": " << EC.message() << '\n';
+        ++Failed;
+        continue;
+      }
+      WriteBitcodeToFile(*M, OS);
+      // A failed write must be cleared, or the stream aborts when destroyed.
+      OS.close();
+      if (OS.has_error()) {
+        std::lock_guard Guard{DiagLock};
+        errs() << OutPath.string() << ": " << OS.error().message() << '\n';
+        OS.clear_error();
+        ++Failed;
+        continue;
+      }
+      Progress.step();
+    }
+  });
+  errs() << '\n';
+
+  if (Failed) {
+    errs() << "Failed: " << Failed.load() << '\n';
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/raw_ostream.h>
+#include "corpus.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+enum class OutputKind { Cost, ConstDist };
+static cl::opt<OutputKind>
+    Kind("kind", cl::desc("Kind of the partial outputs"),
+         cl::values(clEnumValN(OutputKind::Cost, "cost",
+                               "cost.i-of-N.txt of costestimate -shard"),
+                    clEnumValN(OutputKind::ConstDist, "constdist",
+                               "constdist.i-of-N.txt of constextract -shard")),
+         cl::Required);
+static cl::list<std::string> InputFiles(cl::Positional,
+                                        cl::desc("<partial outputs>"),
+                                        cl::OneOrMore);
+static cl::opt<std::string> OutputFile("o", cl::desc("Merged output"),
+                                       cl::Required, cl::value_desc("file"));
+
+// Reads the first line of a partial output, see Shard::getHeader.
+static bool readHeader(std::ifstream &File, const std::string &Path,
+                       Shard &Part) {
+  std::string Line, Tag;
+  std::getline(File, Line);
+  std::istringstream Fields(Line);
+  if (!(Fields >> Tag >> Part.Index >> Part.Count) || Tag != "Shard" ||
+      Part.Index >= Part.Count) {
+    errs() << Path << ": not a partial output of a sharded run\n";
+    return false;
+  }
+  return true;
+}
+
+// Lines of a cost.txt, see costestimate: one line per module with its cost
+// columns, the Total line, with -sample the Estimate and CI95 lines followed
+// by their unrounded EstimateSum and Variance, and the unsupported
+// intrinsics, one per line.
+struct CostFile {
+  std::map<std::string, std::vector<uint64_t>> Modules;
+  // Summed over the shards, as they cover disjoint strata.
+  std::vector<double> Estimate;
+  std::vector<double> Variance;
+  std::set<std::string> Intrinsics;
+  size_t NumColumns = 0;
+  uint32_t NumSampled = 0;
+};
+
+static bool readCosts(std::ifstream &File, const std::string &Path,
+                      CostFile &Merged) {
+  auto CheckColumns = [&](size_t NumColumns) {
+    if (Merged.NumColumns == 0)
+      Merged.NumColumns = NumColumns;
+    if (NumColumns == Merged.NumColumns)
+      return true;
+    errs() << Path << ": expected " << Merged.NumColumns << " cost columns\n";
+    return false;
+  };
+  std::string Line;
+  bool HasEstimate = false;
+  bool HasEstimateSum = false;
+  bool HasVariance = false;
+  while (std::getline(File, Line)) {
+    std::istringstream Fields(Line);
+    std::string Name;
+    if (!(Fields >> Name))
+      continue;
+    if (Name == "EstimateSum" || Name == "Variance") {
+      std::vector<double> Values;
+      for (double Value; Fields >> Value;)
+        Values.push_back(Value);
+      if (!CheckColumns(Values.size()))
+        return false;
+      bool IsEstimate = Name == "EstimateSum";
+      auto &Sums = IsEstimate ? Merged.Estimate : Merged.Variance;
+      Sums.resize(Values.size(), 0.0);
+      for (size_t Col = 0; Col < Values.size(); ++Col)
+        Sums[Col] += Values[Col];
+      (IsEstimate ? HasEstimateSum : HasVariance) = true;
+      continue;
+    }
+    std::vector<uint64_t> Values;
+    for (uint64_t Value; Fields >> Value;)
+      Values.push_back(Value);
+    if (Values.empty()) {
+      Merged.Intrinsics.insert(Name);
+      continue;
+    }
+    if (!CheckColumns(Values.size()))
+      return false;
+    // Recomputed from the module lines and the unrounded sums.
+    if (Name == "Total" || Name == "CI95")
+      continue;
+    if (Name == "Estimate") {
+      HasEstimate = true;
+      continue;
+    }
+    auto [It, Inserted] = Merged.Modules.try_emplace(Name);
+    if (!Inserted) {
+      errs() << Path << ": " << Name << " is in more than one shard\n";
+      return false;
+    }
+    It->second = std::move(Values);
+  }
+  if (HasEstimate != HasEstimateSum || HasEstimate != HasVariance) {
+    errs() << Path << ": Estimate without unrounded EstimateSum and "
+                      "Variance\n";
+    return false;
+  }
+  Merged.NumSampled += HasEstimate;
+  return true;
+}
+
+static bool writeCosts(const CostFile &Merged, std::ofstream &Out) {
+  std::vector<uint64_t> Sum(Merged.NumColumns, 0);
+  for (auto &[Name, Costs] : Merged.Modules) {
+    Out << Name;
+    for (size_t Col = 0; Col < Costs.size(); ++Col) {
+      Out << ' ' << Costs[Col];
+      Sum[Col] += Costs[Col];
+    }
+    Out << '\n';
+  }
+  Out << "Total";
+  for (auto Total : Sum)
+    Out << ' ' << Total;
+  Out << '\n';
+  if (Merged.NumSampled) {
+    Out << "Estimate";
+    for (auto Total : Merged.Estimate)
+      Out << ' ' << std::llround(Total);
+    Out << "\nCI95";
+    for (auto Variance : Merged.Variance)
+      Out << ' ' << std::llround(1.96 * std::sqrt(Variance));
+    Out << '\n';
+  }
+  for (auto &Name : Merged.Intrinsics)
+    Out << Name << '\n';
+  return Out.good();
+}
+
+static bool readConstDist(std::ifstream &File, const std::string &Path,
+                          std::map<int64_t, uint64_t> &Merged) {
+  int64_t Value;
+  uint64_t Count;
+  while (File >> Value >> Count)
+    Merged[Value] += Count;
+  if (!File.eof()) {
+    errs() << Path << ": malformed constant distribution\n";
+    return false;
+  }
+  return true;
+}
+
+// Combines the partial outputs of the shards of a run (see -shard of
+// costestimate and constextract) into the output of an unsharded run. The
+// inputs must be exactly shards 0 to N-1 of one run. Module costs are
+// concatenated and the totals recomputed, sampled estimates and their
+// variances are summed, constant counts are summed, and the unsupported
+// intrinsics are united.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "shard merger\n");
+
+  CostFile Costs;
+  std::map<int64_t, uint64_t> ValDist;
+  std::vector<bool> Seen(InputFiles.size());
+  for (auto &Path : InputFiles) {
+    std::ifstream File(Path);
+    if (!File.is_open()) {
+      errs() << "Cannot open " << Path << '\n';
+      return EXIT_FAILURE;
+    }
+    Shard Part;
+    if (!readHeader(File, Path, Part))
+      return EXIT_FAILURE;
+    // N distinct shards of N make up the whole run.
+    if (Part.Count != Seen.size()) {
+      errs() << Path << ": shard " << Part.Index << " of " << Part.Count
+             << ", but " << Seen.size() << " partial outputs are given\n";
+      return EXIT_FAILURE;
+    }
+    if (Seen[Part.Index]) {
+      errs() << Path << ": shard " << Part.Index << " is given twice\n";
+      return EXIT_FAILURE;
+    }
+    Seen[Part.Index] = true;
+    bool Ok = Kind == OutputKind::Cost ? readCosts(File, Path, Costs)
+                                       : readConstDist(File, Path, ValDist);
+    if (!Ok)
+      return EXIT_FAILURE;
+  }
+  if (Costs.NumSampled && Costs.NumSampled != Seen.size()) {
+    errs() << "Only some of the shards are sampled\n";
+    return EXIT_FAILURE;
+  }
+
+  std::ofstream Out(OutputFile);
+  if (!Out.is_open()) {
+    errs() << "Cannot open " << OutputFile << '\n';
+    return EXIT_FAILURE;
+  }
+  if (Kind == OutputKind::Cost) {
+    if (!writeCosts(Costs, Out))
+      return EXIT_FAILURE;
+    errs() << "Modules: " << Costs.Modules.size() << '\n';
+  } else {
+    for (auto [K, V] : ValDist)
+      Out << K << ' ' << V << '\n';
+    errs() << "Distinct constants: " << ValDist.size() << '\n';
+  }
+  return EXIT_SUCCESS;
+}
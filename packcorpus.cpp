@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Compression.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include "corpus.hpp"
+#include "corpuspack.hpp"
+#include "worker.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace llvm;
+namespace fs = std::filesystem;
+
+static cl::opt<std::string>
+    InputDir(cl::Positional,
+             cl::desc("<directory or pack of input LLVM IR/bitcode files>"),
+             cl::Required, cl::value_desc("inputdir"));
+static cl::opt<std::string> OutputFile(cl::Positional,
+                                       cl::desc("<output pack>"),
+                                       cl::Required, cl::value_desc("file"));
+static cl::opt<uint32_t> Jobs("j",
+                              cl::desc("Number of worker threads (0 = all "
+                                       "hardware threads)"),
+                              cl::init(1), cl::value_desc("N"));
+static cl::opt<bool> Zstd("zstd",
+                          cl::desc("Compress every member with zstd"));
+static cl::opt<int> ZstdLevel("zstd-level",
+                              cl::desc("Compression level of -zstd"),
+                              cl::init(3), cl::value_desc("N"));
+
+// Packs every IR file under inputdir into one corpus pack, largest first so
+// that the scanners pick up big modules early. Members are read and
+// compressed a batch at a time and written in order, so the output does not
+// depend on scheduling and only one batch is held in memory.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "corpus packer\n");
+
+  if (Zstd && !compression::zstd::isAvailable()) {
+    errs() << "-zstd needs LLVM built with zstd\n";
+    return EXIT_FAILURE;
+  }
+
+  InputFeed Inputs{InputDir, "", ""};
+  std::vector<fs::path> Paths;
+  for (fs::path Path; Inputs.pop(Path);)
+    Paths.push_back(std::move(Path));
+  std::string Err;
+  errs() << "Input files: " << Inputs.finish(Err) << '\n';
+  if (!Err.empty()) {
+    errs() << Err << '\n';
+    return EXIT_FAILURE;
+  }
+  sortLargestFirst(Paths, [&](const fs::path &Input) {
+    return Inputs.getSize(Input);
+  });
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutputFile, EC);
+  if (EC) {
+    errs() << OutputFile << ": " << EC.message() << '\n';
+    return EXIT_FAILURE;
+  }
+  CorpusPackWriter Writer{OS};
+
+  struct Member {
+    std::unique_ptr<MemoryBuffer> Buf;
+    SmallVector<uint8_t, 0> Compressed;
+  };
+  uint32_t NumWorkers = getNumWorkers(Jobs);
+  size_t BatchSize = 16 * size_t{NumWorkers};
+  ProgressCounter Progress;
+  uint64_t Size = 0;
+  uint64_t StoredSize = 0;
+  uint32_t Failed = 0;
+  for (size_t Begin = 0; Begin < Paths.size(); Begin += BatchSize) {
+    std::vector<Member> Batch(std::min(BatchSize, Paths.size() - Begin));
+    WorkQueue Queue{Batch.size()};
+    runWorkers(NumWorkers, [&](uint32_t) {
+      size_t Idx;
+      while (Queue.pop(Idx)) {
+        auto &M = Batch[Idx];
+        M.Buf = Inputs.read(Paths[Begin + Idx]);
+        if (M.Buf && Zstd)
+          compression::zstd::compress(
+              arrayRefFromStringRef(M.Buf->getBuffer()), M.Compressed,
+              ZstdLevel);
+      }
+    });
+    for (size_t Idx = 0; Idx < Batch.size(); ++Idx) {
+      auto &Path = Paths[Begin + Idx];
+      auto &M = Batch[Idx];
+      if (!M.Buf) {
+        errs() << "\nCannot read " << Path.string() << '\n';
+        ++Failed;
+        continue;
+      }
+      // Members that do not shrink are stored as is.
+      StringRef Data = M.Buf->getBuffer();
+      StringRef Stored = Data;
+      if (!M.Compressed.empty() && M.Compressed.size() < Data.size())
+        Stored = toStringRef(M.Compressed);
+      Writer.add(Path.lexically_relative(std::string(InputDir))
+                     .generic_string(),
+                 Stored, Data.size());
+      Size += Data.size();
+      StoredSize += Stored.size();
+      Progress.step();
+    }
+  }
+  errs() << '\n';
+  if (!Writer.finish(Err)) {
+    errs() << OutputFile << ": " << Err << '\n';
+    return EXIT_FAILURE;
+  }
+  errs() << "Packed: " << Paths.size() - Failed << " members, " << Size
+         << " bytes stored as " << StoredSize
+         << format(" (%.1f%%)\n", Size ? 100.0 * StoredSize / Size : 0.0);
+  return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,277 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/raw_ostream.h>
+#include "corpus.hpp"
+#include "costmodel.hpp"
+#include "featuredump.hpp"
+#include "isa.hpp"
+#include "ops.hpp"
+#include "worker.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+namespace fs = std::filesystem;
+
+static cl::opt<std::string>
+    InputDir(cl::Positional,
+             cl::desc("<directory or pack of input LLVM IR/bitcode files>"),
+             cl::Optional, cl::value_desc("inputdir"));
+static cl::opt<std::string>
+    FeatureFile("features",
+                cl::desc("Sweep over a costestimate -dump-features file "
+                         "instead of parsing inputdir"),
+                cl::value_desc("file"));
+static cl::opt<std::string>
+    ManifestFile("manifest",
+                 cl::desc("Read the input paths from this file (one per "
+                          "line) instead of walking inputdir"),
+                 cl::value_desc("file"));
+static cl::opt<uint32_t> Jobs("j",
+                              cl::desc("Number of worker threads (0 = all "
+                                       "hardware threads)"),
+                              cl::init(1), cl::value_desc("N"));
+static cl::opt<uint32_t> ModulesPerContext(
+    "modules-per-context",
+    cl::desc("Recreate the LLVMContext after N modules (0 = never)"),
+    cl::init(0), cl::value_desc("N"));
+static cl::opt<std::string>
+    ISAFile("isa", cl::desc("Base ISA description (defaults to immbits.hpp)"),
+            cl::value_desc("file"));
+static cl::list<std::string>
+    Ranges("range",
+           cl::desc("Sweep a field from Lo to Hi inclusive, e.g. "
+                    "AddSubImmBits=8:16 or CmpImmBits=4:12:2"),
+           cl::value_desc("Name=Lo:Hi[:Step]"), cl::OneOrMore);
+static cl::opt<bool>
+    Dynamic("dynamic",
+            cl::desc("Score points by cost weighted by estimated block "
+                     "frequency"));
+static cl::opt<std::string> OutputFile("o",
+                                       cl::desc("Where to write every point"),
+                                       cl::init("sweep.txt"),
+                                       cl::value_desc("file"));
+
+struct SweepAxis {
+  std::string Name;
+  uint64_t Lo;
+  uint64_t Hi;
+  uint64_t Step;
+};
+
+static bool parseAxis(StringRef Spec, SweepAxis &Axis, std::string &Err) {
+  auto [Name, Bounds] = Spec.split('=');
+  auto [Lo, Rest] = Bounds.split(':');
+  auto [Hi, Step] = Rest.split(':');
+  Axis.Name = Name.trim().str();
+  Axis.Step = 1;
+  if (Lo.trim().getAsInteger(10, Axis.Lo) ||
+      Hi.trim().getAsInteger(10, Axis.Hi) ||
+      (!Step.empty() && Step.trim().getAsInteger(10, Axis.Step)) ||
+      Axis.Step == 0 || Axis.Lo > Axis.Hi) {
+    Err = "expected Name=Lo:Hi[:Step] with Lo <= Hi and Step > 0";
+    return false;
+  }
+  ISAConfig Probe;
+  if (!Probe.set(Axis.Name, Axis.Lo) || !Probe.set(Axis.Name, Axis.Hi)) {
+    Err = ISAConfig::getSetError(Axis.Name);
+    return false;
+  }
+  return true;
+}
+
+struct SweepPoint {
+  ISAConfig ISA;
+  // Overrides on top of the base ISA, in -variant syntax.
+  std::string Spec;
+  double OpcodeSpace;
+  uint64_t Cost = 0;
+};
+
+// Enumerates the cartesian product of the axes and keeps the points whose
+// operations still fit in an instruction and admit a prefix-free encoding.
+static std::vector<SweepPoint> enumeratePoints(const ISAConfig &Base,
+                                               ArrayRef<SweepAxis> Axes,
+                                               uint64_t &Rejected) {
+  std::vector<SweepPoint> Points;
+  std::vector<uint64_t> Values;
+  for (auto &Axis : Axes)
+    Values.push_back(Axis.Lo);
+
+  while (true) {
+    SweepPoint Point{Base, "", 0.0};
+    for (size_t I = 0; I < Axes.size(); ++I) {
+      Point.ISA.set(Axes[I].Name, Values[I]);
+      if (I)
+        Point.Spec += ',';
+      Point.Spec += Axes[I].Name + "=" + std::to_string(Values[I]);
+    }
+    auto Ops = getOps(Point.ISA);
+    Point.OpcodeSpace = getOpcodeSpaceUsage(Ops, Point.ISA.InstructionBits);
+    if (isDecodable(Ops, Point.ISA.InstructionBits) && Point.OpcodeSpace <= 1.0)
+      Points.push_back(std::move(Point));
+    else
+      ++Rejected;
+
+    size_t I = 0;
+    for (; I < Axes.size(); ++I) {
+      if (Values[I] + Axes[I].Step <= Axes[I].Hi) {
+        Values[I] += Axes[I].Step;
+        break;
+      }
+      Values[I] = Axes[I].Lo;
+    }
+    if (I == Axes.size())
+      break;
+  }
+  return Points;
+}
+
+// Sweeps immediate widths (or any other ISA field) over the corpus. The IR is
+// parsed once (or not at all when replaying a feature dump); every point is
+// scored from the extracted features.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "ISA design-space sweep\n");
+
+  if (InputDir.empty() == FeatureFile.empty()) {
+    errs() << "Expected either an input directory or -features\n";
+    return EXIT_FAILURE;
+  }
+
+  ISAConfig BaseISA;
+  std::string Err;
+  if (!ISAFile.empty() && !BaseISA.load(ISAFile, Err)) {
+    errs() << Err << '\n';
+    return EXIT_FAILURE;
+  }
+  std::vector<SweepAxis> Axes;
+  for (auto &Spec : Ranges) {
+    SweepAxis Axis;
+    if (!parseAxis(Spec, Axis, Err)) {
+      errs() << "Invalid range '" << Spec << "': " << Err << '\n';
+      return EXIT_FAILURE;
+    }
+    Axes.push_back(std::move(Axis));
+  }
+
+  uint64_t Rejected = 0;
+  auto Points = enumeratePoints(BaseISA, Axes, Rejected);
+  errs() << "Points: " << Points.size() << " (" << Rejected
+         << " not encodable)\n";
+  if (Points.empty())
+    return EXIT_FAILURE;
+
+  uint32_t NumWorkers = getNumWorkers(Jobs);
+  std::vector<std::vector<FunctionFeatures>> Features;
+  if (!FeatureFile.empty()) {
+    std::vector<FeatureModule> Modules;
+    if (!loadFeatureDump(FeatureFile, Modules, Err)) {
+      errs() << Err << '\n';
+      return EXIT_FAILURE;
+    }
+    errs() << "Modules: " << Modules.size() << '\n';
+    for (auto &M : Modules)
+      Features.push_back(std::move(M.Functions));
+  } else {
+    // Functions are grouped by the worker that extracted them; the total
+    // cost does not depend on the grouping.
+    Features.resize(NumWorkers);
+    InputFeed Inputs{InputDir, "/optimized/", ManifestFile};
+    ProgressCounter Progress;
+
+    runWorkers(NumWorkers, [&](uint32_t WorkerIdx) {
+      ContextRecycler Contexts{ModulesPerContext};
+      FeatureAnalyses Analyses;
+      Analyses.BlockFrequencies = Dynamic;
+      fs::path Path;
+      while (Inputs.pop(Path)) {
+        auto Buf = Inputs.read(Path);
+        if (!Buf)
+          continue;
+        auto M = loadModule(std::move(Buf), Contexts.get());
+        if (!M)
+          continue;
+        for (auto &F : *M) {
+          if (!materializeBody(F))
+            continue;
+          Features[WorkerIdx].push_back(extractFeatures(F, Analyses));
+        }
+        Progress.step();
+      }
+    });
+    errs() << '\n';
+    errs() << "Input files: " << Inputs.finish(Err) << '\n';
+    if (!Err.empty()) {
+      errs() << Err << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+
+  WorkQueue PointQueue{Points.size()};
+  runWorkers(NumWorkers, [&](uint32_t) {
+    size_t Idx;
+    while (PointQueue.pop(Idx)) {
+      auto &Point = Points[Idx];
+      CostModel Model{Point.ISA};
+      double DynamicCost = 0.0;
+      for (auto &Functions : Features) {
+        for (auto &F : Functions) {
+          double Cost = 0.0;
+          Point.Cost += evaluateCost(F, Model, nullptr, nullptr,
+                                     Dynamic ? &Cost : nullptr);
+          DynamicCost += Cost;
+        }
+      }
+      if (Dynamic)
+        Point.Cost = std::llround(DynamicCost);
+    }
+  });
+  errs() << "Peak RSS: " << getPeakRSSInMiB() << " MiB\n";
+
+  std::ofstream ResultFile(OutputFile);
+  if (!ResultFile.is_open())
+    return EXIT_FAILURE;
+  ResultFile << std::fixed << std::setprecision(6);
+  for (auto &Point : Points)
+    ResultFile << Point.Cost << ' ' << Point.OpcodeSpace << ' ' << Point.Spec
+               << '\n';
+
+  // A point is on the frontier if no other point is at least as good in both
+  // cost and opcode space and strictly better in one of them.
+  std::vector<const SweepPoint *> Sorted;
+  for (auto &Point : Points)
+    Sorted.push_back(&Point);
+  std::sort(Sorted.begin(), Sorted.end(), [](auto *LHS, auto *RHS) {
+    if (LHS->Cost != RHS->Cost)
+      return LHS->Cost < RHS->Cost;
+    return LHS->OpcodeSpace < RHS->OpcodeSpace;
+  });
+  outs() << "Pareto frontier (cost, opcode space):\n";
+  double BestSpace = 2.0;
+  for (auto *Point : Sorted) {
+    if (Point->OpcodeSpace >= BestSpace)
+      continue;
+    BestSpace = Point->OpcodeSpace;
+    outs() << Point->Cost << format(" %.6f ", Point->OpcodeSpace)
+           << Point->Spec << '\n';
+  }
+
+  return EXIT_SUCCESS;
+}
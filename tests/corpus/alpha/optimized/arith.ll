@@ -0,0 +1,67 @@
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-i128:128-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @imm_widths(i32 %x, i32 %y) {
+entry:
+  %a = add i32 %x, 7
+  %b = add i32 %a, 2047
+  %c = add i32 %b, 65536
+  %d = sub i32 1000, %c
+  %e = and i32 %d, 255
+  %f = or i32 %e, -4096
+  %g = xor i32 %f, %y
+  %h = xor i32 %g, -1
+  ret i32 %h
+}
+
+define i64 @shifts_and_muls(i64 %x, i64 %y, i64 %z) {
+entry:
+  %s = shl i64 %y, 3
+  %a = add i64 %x, %s
+  %m = mul i64 %z, 5
+  %b = add i64 %a, %m
+  %m2 = mul i64 %b, 12345
+  %r = ashr i64 %m2, 7
+  %sub = sub i64 %x, %y
+  %sr = lshr i64 %sub, 2
+  %t = add i64 %r, %sr
+  %big = add i64 %t, 81985529216486895
+  ret i64 %big
+}
+
+define i32 @divs(i32 %x, i32 %y) {
+entry:
+  %a = udiv i32 %x, 16
+  %b = sdiv i32 %y, 7
+  %c = urem i32 %a, 100000
+  %d = srem i32 %b, %x
+  %sub = sub i32 %x, %y
+  %e = udiv i32 %sub, 3
+  %f = add i32 %c, %d
+  %g = add i32 %f, %e
+  ret i32 %g
+}
+
+define i32 @loop(ptr %p, i32 %n) {
+entry:
+  %cmp0 = icmp sgt i32 %n, 0
+  br i1 %cmp0, label %body, label %exit
+
+body:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %body ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %body ]
+  %gep = getelementptr inbounds i32, ptr %p, i32 %i
+  %v = load i32, ptr %gep, align 4
+  %w = mul i32 %v, 4660
+  %acc.next = add i32 %acc, %w
+  store i32 %acc.next, ptr %gep, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %body, label %exit, !prof !0
+
+exit:
+  %res = phi i32 [ 0, %entry ], [ %acc.next, %body ]
+  ret i32 %res
+}
+
+!0 = !{!"branch_weights", i32 100, i32 1}
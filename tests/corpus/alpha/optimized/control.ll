@@ -0,0 +1,65 @@
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-i128:128-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare i32 @callee(i32)
+
+define i32 @selects(i32 %x, i32 %y, i1 %c) {
+entry:
+  %a = select i1 %c, i32 %x, i32 3
+  %b = select i1 %c, i32 100000, i32 %y
+  %cmp = icmp ult i32 %a, 4096
+  %d = select i1 %cmp, i32 -1, i32 0
+  %m = call i32 @llvm.smax.i32(i32 %b, i32 -20)
+  %n = call i32 @llvm.umin.i32(i32 %m, i32 70000)
+  %p = call i32 @llvm.ctpop.i32(i32 %n)
+  %e = add i32 %d, %p
+  ret i32 %e
+}
+
+define i32 @switches(i32 %x) {
+entry:
+  switch i32 %x, label %default [
+    i32 0, label %a
+    i32 17, label %b
+    i32 70000, label %c
+  ]
+
+a:
+  %ra = call i32 @callee(i32 1)
+  br label %exit
+
+b:
+  %rb = call i32 @callee(i32 123456)
+  br label %exit
+
+c:
+  br label %exit
+
+default:
+  %cmp = icmp eq i32 %x, -5
+  br i1 %cmp, label %c, label %exit
+
+exit:
+  %r = phi i32 [ %ra, %a ], [ %rb, %b ], [ 42, %c ], [ 99999, %default ]
+  ret i32 %r
+}
+
+define double @floats(double %x, float %y) {
+entry:
+  %a = fadd double %x, 1.5
+  %b = fmul double %a, 0x400921FB54442D18
+  %c = fdiv double %b, 3.0
+  %e = fpext float %y to double
+  %f = fsub double %c, %e
+  %g = fneg double %f
+  %h = call double @llvm.fabs.f64(double %g)
+  %cmp = fcmp olt double %h, 0.0
+  %i = select i1 %cmp, double 2.0, double %h
+  %j = frem double %i, 7.0
+  ret double %j
+}
+
+declare i32 @llvm.smax.i32(i32, i32)
+declare i32 @llvm.umin.i32(i32, i32)
+declare i32 @llvm.ctpop.i32(i32)
+declare double @llvm.fabs.f64(double)
@@ -0,0 +1,64 @@
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-i128:128-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define <4 x i32> @lanes(<4 x i32> %x, <4 x i32> %y) {
+entry:
+  %a = add <4 x i32> %x, <i32 1, i32 1, i32 1, i32 1>
+  %b = sub <4 x i32> <i32 8, i32 8, i32 8, i32 8>, %a
+  %c = and <4 x i32> %b, <i32 255, i32 255, i32 255, i32 255>
+  %d = shl <4 x i32> %c, <i32 2, i32 2, i32 2, i32 2>
+  %e = mul <4 x i32> %d, %y
+  %cmp = icmp slt <4 x i32> %e, <i32 3, i32 3, i32 3, i32 3>
+  %f = select <4 x i1> %cmp, <4 x i32> %e, <4 x i32> %x
+  %g = shufflevector <4 x i32> %f, <4 x i32> poison, <4 x i32> <i32 3, i32 2, i32 1, i32 0>
+  ret <4 x i32> %g
+}
+
+define i32 @reduce(<8 x i16> %x, i32 %idx) {
+entry:
+  %a = extractelement <8 x i16> %x, i32 0
+  %b = extractelement <8 x i16> %x, i32 %idx
+  %v = insertelement <8 x i16> %x, i16 %a, i32 5
+  %s = call i16 @llvm.vector.reduce.add.v8i16(<8 x i16> %v)
+  %c = add i16 %s, %b
+  %r = zext i16 %c to i32
+  ret i32 %r
+}
+
+define <2 x double> @fvec(<2 x double> %x) {
+entry:
+  %a = fmul <2 x double> %x, <double 2.0, double 2.0>
+  %b = fadd <2 x double> %a, <double 0.5, double 0.5>
+  %cmp = fcmp olt <2 x double> %b, zeroinitializer
+  %c = select <2 x i1> %cmp, <2 x double> zeroinitializer, <2 x double> %b
+  ret <2 x double> %c
+}
+
+define <4 x i32> @splat_imms(<4 x i32> %x, <4 x i32> %y, <4 x i1> %c) {
+entry:
+  %a = call <4 x i32> @llvm.smax.v4i32(<4 x i32> %x, <4 x i32> <i32 -3, i32 -3, i32 -3, i32 -3>)
+  %b = call <4 x i32> @llvm.umin.v4i32(<4 x i32> %a, <4 x i32> <i32 100, i32 100, i32 100, i32 100>)
+  %d = call <4 x i32> @llvm.fshl.v4i32(<4 x i32> %b, <4 x i32> %y, <4 x i32> <i32 5, i32 5, i32 5, i32 5>)
+  %s = sub <4 x i32> %d, %y
+  %e = call <4 x i32> @llvm.abs.v4i32(<4 x i32> %s, i1 false)
+  %f = select <4 x i1> %c, <4 x i32> %e, <4 x i32> <i32 7, i32 7, i32 7, i32 7>
+  ret <4 x i32> %f
+}
+
+define <2 x double> @splat_fp(<2 x double> %x) {
+entry:
+  %a = call <2 x double> @llvm.copysign.v2f64(<2 x double> <double 1.0, double 1.0>, <2 x double> %x)
+  %b = fneg <2 x double> %x
+  %c = call <2 x double> @llvm.fabs.v2f64(<2 x double> %b)
+  %d = fneg <2 x double> %c
+  %e = fadd <2 x double> %a, %d
+  ret <2 x double> %e
+}
+
+declare i16 @llvm.vector.reduce.add.v8i16(<8 x i16>)
+declare <4 x i32> @llvm.smax.v4i32(<4 x i32>, <4 x i32>)
+declare <4 x i32> @llvm.umin.v4i32(<4 x i32>, <4 x i32>)
+declare <4 x i32> @llvm.fshl.v4i32(<4 x i32>, <4 x i32>, <4 x i32>)
+declare <4 x i32> @llvm.abs.v4i32(<4 x i32>, i1)
+declare <2 x double> @llvm.copysign.v2f64(<2 x double>, <2 x double>)
+declare <2 x double> @llvm.fabs.v2f64(<2 x double>)
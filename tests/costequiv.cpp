@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/raw_ostream.h>
+#include "corpus.hpp"
+#include "costmodel.hpp"
+#include "isa.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+namespace fs = std::filesystem;
+
+static cl::opt<std::string> InputDir(cl::Positional,
+                                     cl::desc("<directory of IR files>"),
+                                     cl::Required, cl::value_desc("dir"));
+static cl::opt<uint32_t> NumRandomISAs("random-isas",
+                                       cl::desc("Number of random ISAs"),
+                                       cl::init(64), cl::value_desc("N"));
+
+// The ISAs every function is scored under: the default one, every immediate
+// field set to the same width for a range of widths, and random widths from
+// a fixed seed. Each comes with and without rematerialization and vector
+// registers.
+static std::vector<CostModel> getModels() {
+  std::vector<ISAConfig> ISAs{ISAConfig{}};
+  for (uint32_t Bits : {0, 1, 2, 4, 5, 8, 12, 16, 20, 32, 63, 64}) {
+    ISAConfig ISA;
+#define R6_SET_IMM(Name) ISA.Name = Bits;
+    R6_IMM_FIELDS(R6_SET_IMM)
+#undef R6_SET_IMM
+    ISAs.push_back(ISA);
+  }
+  std::mt19937 Rng{2024};
+  for (uint32_t I = 0; I < NumRandomISAs; ++I) {
+    ISAConfig ISA;
+#define R6_SET_IMM(Name) ISA.Name = Rng() % 65;
+    R6_IMM_FIELDS(R6_SET_IMM)
+#undef R6_SET_IMM
+    ISAs.push_back(ISA);
+  }
+
+  std::vector<CostModel> Models;
+  for (auto &Base : ISAs)
+    for (uint64_t VectorBits : {0, 128})
+      for (auto [Remat, Hoisted] :
+           {std::pair{false, 0U}, std::pair{true, 0U}, std::pair{true, 4U}}) {
+        ISAConfig ISA = Base;
+        ISA.VectorBits = VectorBits;
+        CostModel Model{ISA};
+        Model.Remat = Remat;
+        Model.HoistedConstants = Hoisted;
+        Models.push_back(Model);
+      }
+  return Models;
+}
+
+// Scores every function of the IR files under inputdir with evaluateCost and
+// with evaluateCostReference under a fixed set of ISAs, and fails on any
+// difference in the cost, the class breakdown, the dynamic cost or the
+// unsupported intrinsics.
+int main(int argc, char **argv) {
+  InitLLVM Init{argc, argv};
+  cl::ParseCommandLineOptions(argc, argv, "evaluator equivalence test\n");
+
+  auto Models = getModels();
+  InputFeed Inputs{InputDir, "", ""};
+  FeatureAnalyses Analyses;
+  Analyses.BlockFrequencies = true;
+  uint32_t NumFunctions = 0;
+  uint32_t Failed = 0;
+  for (fs::path Path; Inputs.pop(Path);) {
+    LLVMContext Context;
+    auto M = loadModule(Path, Context);
+    if (!M)
+      return EXIT_FAILURE;
+    for (auto &F : *M) {
+      if (!materializeBody(F))
+        continue;
+      auto Features = extractFeatures(F, Analyses);
+      ++NumFunctions;
+      for (size_t Idx = 0; Idx < Models.size(); ++Idx) {
+        std::set<std::string> Intrinsics, RefIntrinsics;
+        CostBreakdown Breakdown{}, RefBreakdown{};
+        double Dynamic = 0.0, RefDynamic = 0.0;
+        uint64_t Cost = evaluateCost(Features, Models[Idx], &Intrinsics,
+                                     &Breakdown, &Dynamic);
+        uint64_t RefCost = evaluateCostReference(
+            Features, Models[Idx], &RefIntrinsics, &RefBreakdown, &RefDynamic);
+        if (Cost == RefCost && Intrinsics == RefIntrinsics &&
+            Breakdown == RefBreakdown && Dynamic == RefDynamic)
+          continue;
+        errs() << Path.string() << ": " << F.getName()
+               << " differs under model " << Idx << ": " << Cost << " vs "
+               << RefCost << '\n';
+        ++Failed;
+      }
+    }
+  }
+  std::string Err;
+  Inputs.finish(Err);
+  if (!Err.empty()) {
+    errs() << Err << '\n';
+    return EXIT_FAILURE;
+  }
+  if (NumFunctions == 0) {
+    errs() << "No functions in " << InputDir << '\n';
+    return EXIT_FAILURE;
+  }
+  outs() << "Functions: " << NumFunctions << ", models: " << Models.size()
+         << ", differences: " << Failed << '\n';
+  return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
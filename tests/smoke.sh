@@ -0,0 +1,123 @@
+#!/bin/sh
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (c) 2024 Yingwei Zheng
+# This file is licensed under the Apache-2.0 License.
+# See the LICENSE file for more information.
+
+# Smoke tests of the tools' file formats, run by ctest:
+#   smoke.sh <case> <directory of the tools> <corpus directory>
+# Every case runs in a scratch directory, as the tools write cost.txt and
+# constdist.txt to the working directory.
+set -eu
+Case=$1
+Bin=$2
+Corpus=$3
+Work=$(mktemp -d)
+trap 'rm -rf "$Work"' EXIT
+cd "$Work"
+
+fail() {
+  echo "$Case: $*" >&2
+  exit 1
+}
+
+# Overwrites the four bytes at offset $2 of file $1 with 0xffffffff.
+corrupt32() {
+  printf '\377\377\377\377' |
+    dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+case $Case in
+featuredump)
+  # Replaying a dump gives the costs of the scan that wrote it.
+  "$Bin/costestimate" "$Corpus" -dynamic -dump-features=features.bin
+  mv cost.txt scanned.txt
+  "$Bin/costestimate" -replay=features.bin -dynamic
+  cmp scanned.txt cost.txt || fail "replayed costs differ"
+  # Truncated dumps and impossible module counts are rejected.
+  head -c "$(($(wc -c <features.bin) / 2))" features.bin >truncated.bin
+  if "$Bin/costestimate" -replay=truncated.bin; then
+    fail "accepted a truncated dump"
+  fi
+  cp features.bin corrupt.bin
+  corrupt32 corrupt.bin 8
+  if "$Bin/costestimate" -replay=corrupt.bin; then
+    fail "accepted a corrupt module count"
+  fi
+  ;;
+costtable)
+  # The -function-costs table has the layout of writeFunctionCosts, and
+  # the function costs of every column add up to the Total line.
+  "$Bin/costestimate" "$Corpus" -variant=AddSubImmBits=5 \
+    -function-costs=functions.bin
+  [ "$(head -c 4 functions.bin)" = R6FC ] || fail "bad magic"
+  set -- $(od -An -v -tu4 -j4 -N8 functions.bin)
+  [ "$1" = 1 ] || fail "unexpected version $1"
+  [ "$2" = 2 ] || fail "expected 2 cost columns, got $2"
+  set -- $(od -An -v -tu8 -j12 -N64 functions.bin)
+  Size=76
+  for Column; do
+    Size=$((Size + Column))
+  done
+  [ "$(wc -c <functions.bin)" -eq "$Size" ] || fail "column sizes"
+  # Modules and function costs, see FunctionCostColumn.
+  Functions=$(od -An -v -tu4 -j$((76 + $1)) -N"$2" functions.bin |
+    awk '{ for (I = 1; I <= NF; ++I) N += $I } END { print N }')
+  [ "$Functions" -gt 0 ] || fail "no functions"
+  [ "$4" -eq $((Functions * 2 * 8)) ] || fail "function cost column size"
+  Totals=$(od -An -v -tu8 -j$((76 + $1 + $2 + $3)) -N"$4" functions.bin |
+    awk '{ for (I = 1; I <= NF; ++I) Sum[N++ % 2] += $I }
+         END { print "Total", Sum[0], Sum[1] }')
+  [ "$Totals" = "$(grep '^Total ' cost.txt)" ] ||
+    fail "function costs do not add up to the module costs"
+  ;;
+corpuspack)
+  # Scanning a pack gives the costs of scanning the directory it was built
+  # from, with members stored as is and, where LLVM has zstd, compressed.
+  "$Bin/costestimate" "$Corpus"
+  mv cost.txt scanned.txt
+  "$Bin/packcorpus" "$Corpus" corpus.pack
+  "$Bin/costestimate" corpus.pack
+  cmp scanned.txt cost.txt || fail "costs of the pack differ"
+  if "$Bin/packcorpus" -zstd "$Corpus" zstd.pack 2>zstd.txt; then
+    "$Bin/costestimate" zstd.pack
+    cmp scanned.txt cost.txt || fail "costs of the zstd pack differ"
+  elif ! grep -q "needs LLVM built with zstd" zstd.txt; then
+    fail "packcorpus -zstd failed"
+  fi
+  # An index offset past the end of the pack is rejected.
+  cp corpus.pack corrupt.pack
+  corrupt32 corrupt.pack 12
+  if "$Bin/costestimate" corrupt.pack; then
+    fail "accepted a corrupt index offset"
+  fi
+  ;;
+mergeshards)
+  # Merging the shards of a run gives the output of the unsharded run, in
+  # any order of the shards.
+  for Options in "" -sample=0.5; do
+    "$Bin/costestimate" "$Corpus" $Options
+    "$Bin/costestimate" "$Corpus" $Options -shard=0/2
+    "$Bin/costestimate" "$Corpus" $Options -shard=1/2
+    "$Bin/mergeshards" -kind=cost cost.1-of-2.txt cost.0-of-2.txt \
+      -o merged.txt
+    cmp cost.txt merged.txt || fail "merged costs differ ($Options)"
+  done
+  "$Bin/constextract" "$Corpus"
+  "$Bin/constextract" "$Corpus" -shard=0/2
+  "$Bin/constextract" "$Corpus" -shard=1/2
+  "$Bin/mergeshards" -kind=constdist constdist.0-of-2.txt \
+    constdist.1-of-2.txt -o merged.txt
+  cmp constdist.txt merged.txt || fail "merged constants differ"
+  # Incomplete sets, repeated shards and unsharded outputs are rejected.
+  for Inputs in "cost.0-of-2.txt" "cost.0-of-2.txt cost.0-of-2.txt" \
+    "cost.0-of-2.txt cost.txt"; do
+    if "$Bin/mergeshards" -kind=cost $Inputs -o merged.txt; then
+      fail "merged $Inputs"
+    fi
+  done
+  ;;
+*)
+  fail "unknown case"
+  ;;
+esac
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (c) 2024 Yingwei Zheng
+// This file is licensed under the Apache-2.0 License.
+// See the LICENSE file for more information.
+
+#pragma once
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Hands out input indices [0, Size) to workers in order.
+class WorkQueue final {
+  std::atomic<size_t> Next{0};
+  size_t Size;
+
+public:
+  explicit WorkQueue(size_t Size) : Size{Size} {}
+
+  bool pop(size_t &Idx) {
+    Idx = Next.fetch_add(1, std::memory_order_relaxed);
+    return Idx < Size;
+  }
+};
+
+class ProgressCounter final {
+  std::mutex Lock;
+  uint32_t Count = 0;
+
+public:
+  void step() {
+    std::lock_guard Guard{Lock};
+    llvm::errs() << "\rProgress: " << ++Count;
+  }
+};
+
+// Orders inputs largest first so that big modules (e.g. sqlite3.c, abc.c) are
+// picked up early and do not end up as stragglers on a single worker. Ties
+// are broken by path to keep the order deterministic. GetSize returns the
+// size of an input.
+template <typename SizeFn>
+void sortLargestFirst(std::vector<std::filesystem::path> &Files,
+                      SizeFn GetSize) {
+  std::vector<std::pair<uintmax_t, std::filesystem::path>> Sized;
+  Sized.reserve(Files.size());
+  for (auto &Path : Files) {
+    uintmax_t Size = GetSize(Path);
+    Sized.emplace_back(Size, std::move(Path));
+  }
+  std::sort(Sized.begin(), Sized.end(), [](const auto &LHS, const auto &RHS) {
+    if (LHS.first != RHS.first)
+      return LHS.first > RHS.first;
+    return LHS.second < RHS.second;
+  });
+  for (size_t I = 0; I < Files.size(); ++I)
+    Files[I] = std::move(Sized[I].second);
+}
+
+inline void sortLargestFirst(std::vector<std::filesystem::path> &Files) {
+  sortLargestFirst(Files, [](const std::filesystem::path &Path) {
+    std::error_code EC;
+    auto Size = std::filesystem::file_size(Path, EC);
+    return EC ? 0 : Size;
+  });
+}
+
+// Hands out an LLVMContext that is thrown away after Limit modules, so that
+// types and constants interned by earlier modules do not pile up. A limit of
+// zero keeps the same context for the whole run. Modules obtained from a
+// context must be destroyed before the next call to get().
+class ContextRecycler final {
+  std::unique_ptr<llvm::LLVMContext> Context;
+  uint32_t Uses = 0;
+  uint32_t Limit;
+
+public:
+  explicit ContextRecycler(uint32_t Limit) : Limit{Limit} {}
+
+  llvm::LLVMContext &get() {
+    if (!Context || (Limit != 0 && Uses == Limit)) {
+      Context.reset();
+      Context = std::make_unique<llvm::LLVMContext>();
+      Uses = 0;
+    }
+    ++Uses;
+    return *Context;
+  }
+};
+
+// Peak resident set size of this process in MiB.
+inline uint64_t getPeakRSSInMiB() {
+  rusage Usage{};
+  if (getrusage(RUSAGE_SELF, &Usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return static_cast<uint64_t>(Usage.ru_maxrss) >> 20;
+#else
+  return static_cast<uint64_t>(Usage.ru_maxrss) >> 10;
+#endif
+}
+
+// Asks the kernel to read Path into the page cache in the background, so
+// that it is resident by the time a worker maps it.
+inline void adviseWillNeed(const std::filesystem::path &Path) {
+#ifdef POSIX_FADV_WILLNEED
+  int FD = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (FD < 0)
+    return;
+  ::posix_fadvise(FD, 0, 0, POSIX_FADV_WILLNEED);
+  ::close(FD);
+#endif
+}
+
+// Passes Advice (e.g. MADV_WILLNEED) to madvise() for the pages that hold
+// Data, which must lie in a file mapping.
+inline void adviseMapping(llvm::StringRef Data, int Advice) {
+  if (Data.empty())
+    return;
+  auto PageMask = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE)) - 1;
+  auto Begin = reinterpret_cast<uintptr_t>(Data.data()) & ~PageMask;
+  auto End = reinterpret_cast<uintptr_t>(Data.data() + Data.size());
+  ::madvise(reinterpret_cast<void *>(Begin), End - Begin, Advice);
+}
+
+inline uint32_t getNumWorkers(uint32_t Jobs) {
+  if (Jobs != 0)
+    return Jobs;
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// Runs Worker(WorkerIdx) on NumWorkers threads and waits for all of them.
+// A single worker runs on the calling thread.
+template <typename Fn> void runWorkers(uint32_t NumWorkers, Fn &&Worker) {
+  if (NumWorkers == 1) {
+    Worker(0U);
+    return;
+  }
+
+  std::vector<std::thread> Threads;
+  Threads.reserve(NumWorkers);
+  for (uint32_t I = 0; I < NumWorkers; ++I)
+    Threads.emplace_back([&Worker, I] { Worker(I); });
+  for (auto &Thread : Threads)
+    Thread.join();
+}